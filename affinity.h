@@ -0,0 +1,130 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+// CPU pinning and NUMA placement for the driver and simulator threads.
+//
+// A placement is a list of role=cpu pairs, e.g. "reader=2,listener=3,sim=3":
+//
+//     reader     the driver's interrupt reader. Dispatch and the LED round
+//                trip run inline on it, so they share its CPU; with an
+//                event queue (keyboard -q) they get a thread of their own,
+//                pinned the same way
+//     listener   the simulator's control_listener
+//     sim        the simulator thread feeding the interrupt endpoint
+//
+// Roles left out float as before. The shared regions (the LED byte and the
+// ring) are bound to a memory node before they are first touched: the one
+// given with aff_node, otherwise the reader's, since it is the one writing
+// the LEDs and draining the ring. mbind is called directly so there is no
+// libnuma to link. Needs _GNU_SOURCE defined before the first include.
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define AFF_READER   0
+#define AFF_LISTENER 1
+#define AFF_SIM      2
+#define AFF_ROLES    3
+
+#define AFF_MPOL_PREFERRED 1
+
+static const char* aff_role_name[AFF_ROLES] = { "reader", "listener", "sim" };
+static int aff_cpu[AFF_ROLES] = { -1, -1, -1 };
+static int aff_node = -1;   // memory node for shared regions, -1 for the reader's
+static int aff_verbose = 0; // report where each role ended up
+
+// "reader=2,sim=3", returns -1 on a malformed spec
+static inline int aff_parse(const char* spec) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", spec);
+
+    for (char* tok = strtok(buf, ","); tok; tok = strtok(NULL, ",")) {
+        char* eq = strchr(tok, '=');
+        if (!eq) return -1;
+        *eq = 0;
+
+        int role = -1;
+        for (int i = 0; i < AFF_ROLES; i++)
+            if (!strcmp(tok, aff_role_name[i])) role = i;
+        if (role < 0 || eq[1] < '0' || eq[1] > '9') return -1;
+        aff_cpu[role] = atoi(eq + 1);
+    }
+    aff_verbose = 1;
+    return 0;
+}
+
+// node a CPU belongs to, from sysfs; 0 on machines without NUMA
+static inline int aff_cpu_node(int cpu) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+
+    DIR* dir = opendir(path);
+    if (!dir) return 0;
+    int node = 0;
+    struct dirent* d;
+    while ((d = readdir(dir)))
+        if (!strncmp(d->d_name, "node", 4) && d->d_name[4] >= '0' && d->d_name[4] <= '9') node = atoi(d->d_name + 4);
+    closedir(dir);
+    return node;
+}
+
+// fails early, before any process depends on the roles being placed, if a
+// configured CPU is not one this process may run on
+static inline void aff_check() {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+        perror("sched_getaffinity failed");
+        exit(1);
+    }
+    for (int i = 0; i < AFF_ROLES; i++) {
+        if (aff_cpu[i] >= 0 && (aff_cpu[i] >= CPU_SETSIZE || !CPU_ISSET(aff_cpu[i], &allowed))) {
+            fprintf(stderr, "unable to pin %s: cpu %d is not available\n", aff_role_name[i], aff_cpu[i]);
+            exit(1);
+        }
+    }
+}
+
+// pins the calling thread to the CPU configured for its role
+static inline void aff_pin(int role) {
+    if (aff_cpu[role] >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(aff_cpu[role], &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err) {
+            fprintf(stderr, "unable to pin %s to cpu %d: %s\n", aff_role_name[role], aff_cpu[role], strerror(err));
+            exit(1);
+        }
+    }
+    if (aff_verbose) {
+        int cpu = sched_getcpu();
+        fprintf(stderr, "affinity: %s on cpu %d node %d%s\n", aff_role_name[role], cpu, aff_cpu_node(cpu),
+            aff_cpu[role] < 0 ? " (floating)" : "");
+    }
+}
+
+static inline int aff_mem_node() {
+    if (aff_node >= 0) return aff_node;
+    if (aff_cpu[AFF_READER] >= 0) return aff_cpu_node(aff_cpu[AFF_READER]);
+    return -1;
+}
+
+// prefers the placement node for a fresh mapping; call before first touch
+static inline void aff_bind(void* addr, size_t len) {
+    int node = aff_mem_node();
+    if (node < 0) return;
+
+    unsigned long mask = 1ul << node;
+    if (syscall(SYS_mbind, addr, len, AFF_MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0) < 0) {
+        perror("mbind failed");
+        exit(1);
+    }
+}
+
+#endif
@@ -0,0 +1,340 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// False-sharing benchmark for the kbd2.c layout of struct usb_kbd and
+// struct urb, before and after splitting hot per-endpoint state onto its
+// own cache lines.
+//
+// A key thread and an LED thread do what kbd2's endpoint threads do per
+// transfer: read the keyboard config, take their URB, fill in its status
+// and length and release it; the LED thread also takes leds_lock. For each
+// layout it prints a perf c2c-style table of the cache lines both threads
+// touch (a line one thread writes and the other accesses is where HITMs
+// come from), then the transfers/sec with the threads pinned apart.
+// Under perf, `perf c2c record ./c2cbench` shows the measured HITMs.
+
+#define CACHE_LINE 64
+
+typedef void (*urb_complete_t)(void*);
+
+// kbd2.c before: hot and read-mostly fields mixed, URBs from malloc
+struct urb_packed {
+    int type;
+    void* transfer_buffer;
+    int transfer_buffer_length;
+    urb_complete_t complete;
+    void* context;
+    int pipe;
+    int status;
+    int actual_length;
+    pthread_t thread;
+    int active;
+};
+
+struct usb_kbd_packed {
+    void* dev;
+    int int_ep_fd;
+    int ctrl_cmd_fd;
+    int ctrl_ack_fd;
+    unsigned char* leds;
+    pthread_mutex_t leds_lock;
+    struct urb_packed* irq_urb;
+    struct urb_packed* led_urb;
+    int open;
+};
+
+// kbd2.c after
+struct urb_split {
+    int type;
+    int pipe;
+    void* transfer_buffer;
+    int transfer_buffer_length;
+    urb_complete_t complete;
+    void* context;
+    pthread_t thread;
+
+    int status __attribute__((aligned(CACHE_LINE)));
+    int actual_length;
+    int active;
+} __attribute__((aligned(CACHE_LINE)));
+
+struct usb_kbd_split {
+    void* dev;
+    int int_ep_fd;
+    int ctrl_cmd_fd;
+    int ctrl_ack_fd;
+    int open;
+    unsigned char* leds;
+    struct urb_split* irq_urb;
+    struct urb_split* led_urb;
+
+    pthread_mutex_t leds_lock __attribute__((aligned(CACHE_LINE)));
+} __attribute__((aligned(CACHE_LINE)));
+
+struct usb_kbd_packed kbd_packed;
+struct usb_kbd_split kbd_split;
+
+#define KEY 1
+#define LED 2
+
+// one field as the endpoint threads use it
+struct access {
+    const char* name;
+    void* addr;
+    size_t size;
+    int readers;
+    int writers;
+};
+
+#define MAX_ACCESS 32
+
+struct layout {
+    const char* name;
+    struct access acc[MAX_ACCESS];
+    int n;
+    void* (*key_thread)(void*);
+    void* (*led_thread)(void*);
+};
+
+void add(struct layout* l, const char* name, void* addr, size_t size, int readers, int writers) {
+    l->acc[l->n++] = (struct access){ name, addr, size, readers, writers };
+}
+
+#define ADD(l, obj, field, r, w) add(l, #obj "." #field, &(obj)->field, sizeof((obj)->field), r, w)
+
+long iterations;
+volatile int go;
+int cpus[2];
+
+void pin(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+void wait_go(int cpu) {
+    pin(cpu);
+    while (!go) sched_yield();
+}
+
+// the per-transfer work of kbd2's threads; the empty asm keeps the stores
+#define TOUCH() __asm__ volatile("" ::: "memory")
+
+void* key_packed(void* arg) {
+    struct usb_kbd_packed* k = &kbd_packed;
+    wait_go(cpus[0]);
+    for (long i = 0; i < iterations; i++) {
+        struct urb_packed* u = k->irq_urb;
+        u->active = 1;
+        u->status = k->int_ep_fd + k->open + (u->context != NULL) + (u->transfer_buffer != NULL);
+        u->actual_length = 1;
+        u->active = 0;
+        TOUCH();
+    }
+    return NULL;
+}
+
+void* led_packed(void* arg) {
+    struct usb_kbd_packed* k = &kbd_packed;
+    wait_go(cpus[1]);
+    for (long i = 0; i < iterations; i++) {
+        struct urb_packed* u = k->led_urb;
+        u->active = 1;
+        pthread_mutex_lock(&k->leds_lock);
+        u->status = k->ctrl_cmd_fd + k->ctrl_ack_fd + (k->leds != NULL) + (u->context != NULL);
+        pthread_mutex_unlock(&k->leds_lock);
+        u->actual_length = 1;
+        u->active = 0;
+        TOUCH();
+    }
+    return NULL;
+}
+
+void* key_split(void* arg) {
+    struct usb_kbd_split* k = &kbd_split;
+    wait_go(cpus[0]);
+    for (long i = 0; i < iterations; i++) {
+        struct urb_split* u = k->irq_urb;
+        u->active = 1;
+        u->status = k->int_ep_fd + k->open + (u->context != NULL) + (u->transfer_buffer != NULL);
+        u->actual_length = 1;
+        u->active = 0;
+        TOUCH();
+    }
+    return NULL;
+}
+
+void* led_split(void* arg) {
+    struct usb_kbd_split* k = &kbd_split;
+    wait_go(cpus[1]);
+    for (long i = 0; i < iterations; i++) {
+        struct urb_split* u = k->led_urb;
+        u->active = 1;
+        pthread_mutex_lock(&k->leds_lock);
+        u->status = k->ctrl_cmd_fd + k->ctrl_ack_fd + (k->leds != NULL) + (u->context != NULL);
+        pthread_mutex_unlock(&k->leds_lock);
+        u->actual_length = 1;
+        u->active = 0;
+        TOUCH();
+    }
+    return NULL;
+}
+
+void setup_packed(struct layout* l) {
+    struct usb_kbd_packed* k = &kbd_packed;
+    pthread_mutex_init(&k->leds_lock, NULL);
+    k->irq_urb = malloc(sizeof(struct urb_packed));
+    k->led_urb = malloc(sizeof(struct urb_packed));
+    memset(k->irq_urb, 0, sizeof(struct urb_packed));
+    memset(k->led_urb, 0, sizeof(struct urb_packed));
+    struct urb_packed* irq = k->irq_urb;
+    struct urb_packed* led = k->led_urb;
+
+    l->name = "packed (kbd2.c before)";
+    ADD(l, k, dev, KEY | LED, 0);
+    ADD(l, k, int_ep_fd, KEY, 0);
+    ADD(l, k, ctrl_cmd_fd, LED, 0);
+    ADD(l, k, ctrl_ack_fd, LED, 0);
+    ADD(l, k, leds, LED, 0);
+    ADD(l, k, leds_lock, LED, LED);
+    ADD(l, k, irq_urb, KEY, 0);
+    ADD(l, k, led_urb, LED, 0);
+    ADD(l, k, open, KEY | LED, 0);
+    ADD(l, irq, transfer_buffer, KEY, 0);
+    ADD(l, irq, context, KEY, 0);
+    ADD(l, irq, status, 0, KEY);
+    ADD(l, irq, actual_length, 0, KEY);
+    ADD(l, irq, active, KEY, KEY);
+    ADD(l, led, transfer_buffer, LED, 0);
+    ADD(l, led, context, LED, 0);
+    ADD(l, led, status, 0, LED);
+    ADD(l, led, actual_length, 0, LED);
+    ADD(l, led, active, LED, LED);
+    l->key_thread = key_packed;
+    l->led_thread = led_packed;
+}
+
+void setup_split(struct layout* l) {
+    struct usb_kbd_split* k = &kbd_split;
+    pthread_mutex_init(&k->leds_lock, NULL);
+    k->irq_urb = aligned_alloc(CACHE_LINE, sizeof(struct urb_split));
+    k->led_urb = aligned_alloc(CACHE_LINE, sizeof(struct urb_split));
+    memset(k->irq_urb, 0, sizeof(struct urb_split));
+    memset(k->led_urb, 0, sizeof(struct urb_split));
+    struct urb_split* irq = k->irq_urb;
+    struct urb_split* led = k->led_urb;
+
+    l->name = "split (kbd2.c after)";
+    ADD(l, k, dev, KEY | LED, 0);
+    ADD(l, k, int_ep_fd, KEY, 0);
+    ADD(l, k, ctrl_cmd_fd, LED, 0);
+    ADD(l, k, ctrl_ack_fd, LED, 0);
+    ADD(l, k, leds, LED, 0);
+    ADD(l, k, leds_lock, LED, LED);
+    ADD(l, k, irq_urb, KEY, 0);
+    ADD(l, k, led_urb, LED, 0);
+    ADD(l, k, open, KEY | LED, 0);
+    ADD(l, irq, transfer_buffer, KEY, 0);
+    ADD(l, irq, context, KEY, 0);
+    ADD(l, irq, status, 0, KEY);
+    ADD(l, irq, actual_length, 0, KEY);
+    ADD(l, irq, active, KEY, KEY);
+    ADD(l, led, transfer_buffer, LED, 0);
+    ADD(l, led, context, LED, 0);
+    ADD(l, led, status, 0, LED);
+    ADD(l, led, actual_length, 0, LED);
+    ADD(l, led, active, LED, LED);
+    l->key_thread = key_split;
+    l->led_thread = led_split;
+}
+
+const char* who(int mask) {
+    static const char* names[] = { "-", "key", "led", "key+led" };
+    return names[mask & 3];
+}
+
+// perf c2c-style shared line table: lines touched by both threads where
+// at least one of them writes. Returns the number of such lines.
+int report_lines(struct layout* l) {
+    uintptr_t lines[MAX_ACCESS];
+    int nlines = 0, shared = 0;
+
+    for (int i = 0; i < l->n; i++) {
+        uintptr_t line = (uintptr_t)l->acc[i].addr / CACHE_LINE;
+        int seen = 0;
+        for (int j = 0; j < nlines; j++) seen |= lines[j] == line;
+        if (!seen) lines[nlines++] = line;
+    }
+
+    printf("%s\n", l->name);
+    printf("  %-18s %-8s %-8s %s\n", "line", "writers", "readers", "fields");
+    for (int j = 0; j < nlines; j++) {
+        int readers = 0, writers = 0;
+        for (int i = 0; i < l->n; i++) {
+            if ((uintptr_t)l->acc[i].addr / CACHE_LINE != lines[j]) continue;
+            readers |= l->acc[i].readers;
+            writers |= l->acc[i].writers;
+        }
+        int hitm = writers && (readers | writers) == (KEY | LED);
+        shared += hitm;
+
+        printf("  %#-18lx %-8s %-8s", (unsigned long)(lines[j] * CACHE_LINE), who(writers), who(readers));
+        for (int i = 0; i < l->n; i++)
+            if ((uintptr_t)l->acc[i].addr / CACHE_LINE == lines[j]) printf(" %s", l->acc[i].name);
+        printf("%s\n", hitm ? "   <- shared, HITM" : "");
+    }
+    return shared;
+}
+
+double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double run(struct layout* l) {
+    pthread_t key, led;
+    go = 0;
+    pthread_create(&key, NULL, l->key_thread, NULL);
+    pthread_create(&led, NULL, l->led_thread, NULL);
+
+    double start = now_sec();
+    go = 1;
+    pthread_join(key, NULL);
+    pthread_join(led, NULL);
+    return now_sec() - start;
+}
+
+int main(int argc, char* argv[]) {
+    iterations = argc > 1 ? atol(argv[1]) : 20000000;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    cpus[0] = 0;
+    cpus[1] = ncpu > 1 ? 1 : 0;
+
+    struct layout layouts[2] = { 0 };
+    setup_packed(&layouts[0]);
+    setup_split(&layouts[1]);
+
+    int shared[2];
+    for (int i = 0; i < 2; i++) {
+        shared[i] = report_lines(&layouts[i]);
+        printf("  %d shared line(s)\n\n", shared[i]);
+    }
+
+    printf("key thread on cpu %d, led thread on cpu %d, %ld transfers each%s\n", cpus[0], cpus[1], iterations,
+        ncpu > 1 ? "" : " (one CPU: lines never bounce, timings only show the layout cost)");
+    for (int i = 0; i < 2; i++) {
+        double secs = run(&layouts[i]);
+        printf("  %-24s %8.3fs  %7.2f M transfers/sec\n", layouts[i].name, secs, 2 * iterations / secs / 1e6);
+    }
+    return 0;
+}
@@ -0,0 +1,152 @@
+#ifndef DEBOUNCE_H
+#define DEBOUNCE_H
+
+// Debounce stage between the key bitmap (keybits.h) and the handlers.
+//
+// Time is counted in polls: every interrupt report, NO_EVENT included, is
+// one tick. A bounce is a contact that opens and closes again: a press that
+// comes within the window after the same key was released. Each key has an
+// 8-bit timer that its release arms to one past the window, and:
+//   - a key released and named again in one report is a second keystroke
+//     (keybits.h), not a bounce: no poll has gone by, so the press finds
+//     the timer as armed and goes through
+//   - a press that goes through clears every timer: once the typist has
+//     moved on to a key, the next press of another one is meant
+//   - a bounce is dropped and counted, and leaves the timer to its release
+// Double letters and keys typed again after another key are never bounces;
+// only a key that comes back after idle polls inside the window is.
+//   eager     a press goes through at once
+//   deferred  a press is held until its key has been quiet for the window,
+//             so the LED round trip happens once the contact has settled.
+//             Held presses go out in arrival order, behind any held before
+//             them.
+//
+// The timers live in 32-byte vectors, 32 keys each, and a tick counts all
+// of them down with a few vector ops. With no timer running and nothing
+// held a tick costs one byte test, so many devices can share one core.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEB_OFF      0
+#define DEB_EAGER    1
+#define DEB_DEFERRED 2
+
+#define DEB_WINDOW   5     // polls; 5 ms at 1 kHz
+#define DEB_KEYS     256
+#define DEB_CHUNKS   (DEB_KEYS / 32)
+#define DEB_HELD     64    // deferred presses in flight
+
+typedef uint8_t deb_vec __attribute__((vector_size(32), aligned(8)));
+
+struct debounce {
+    deb_vec timer[DEB_CHUNKS];
+    uint8_t busy;                       // chunks with a timer running
+    int mode;
+    uint8_t window;
+    unsigned long polls;
+
+    // deferred presses, oldest first
+    struct {
+        unsigned long due;
+        uint8_t usage;
+        uint8_t mods;
+    } held[DEB_HELD];
+    unsigned head;
+    unsigned count;
+
+    // counters
+    unsigned long passed;
+    unsigned long suppressed;
+};
+
+// a press that made it through
+typedef void (*deb_cb)(int usage, int mods, void* arg);
+
+static inline void deb_init(struct debounce* d, int mode, unsigned window) {
+    memset(d, 0, sizeof(*d));
+    d->mode = mode;
+    d->window = window < 1 ? 1 : window > 254 ? 254 : window;
+}
+
+// delivers the oldest held press
+static inline void deb_deliver(struct debounce* d, deb_cb cb, void* arg) {
+    int usage = d->held[d->head].usage, mods = d->held[d->head].mods;
+    d->head = (d->head + 1) % DEB_HELD;
+    d->count--;
+    d->passed++;
+    cb(usage, mods, arg);
+}
+
+static inline void deb_release(struct debounce* d, int usage) {
+    ((uint8_t*)d->timer)[usage] = d->window + 1;
+    d->busy |= 1 << (usage / 32);
+}
+
+// a press off the bitmap; 1 if it goes through now
+static inline int deb_press(struct debounce* d, int usage, int mods, deb_cb cb, void* arg) {
+    uint8_t t = ((uint8_t*)d->timer)[usage];
+    if (t && t <= d->window) {
+        d->suppressed++;
+        // still held: it goes out once the key has been quiet for the window
+        for (unsigned i = 0; i < d->count; i++) {
+            unsigned at = (d->head + i) % DEB_HELD;
+            if (d->held[at].usage == usage) d->held[at].due = d->polls + d->window;
+        }
+        return 0;
+    }
+    memset(d->timer, 0, sizeof(d->timer));
+    d->busy = 0;
+
+    if (d->mode == DEB_EAGER) {
+        d->passed++;
+        return 1;
+    }
+    if (d->count == DEB_HELD) deb_deliver(d, cb, arg);
+    unsigned at = (d->head + d->count++) % DEB_HELD;
+    d->held[at].due = d->polls + d->window;
+    d->held[at].usage = usage;
+    d->held[at].mods = mods;
+    return 0;
+}
+
+// one poll: counts every running timer down, then delivers the held
+// presses that are due. A press held behind one still waiting waits too.
+static inline void deb_tick(struct debounce* d, deb_cb cb, void* arg) {
+    d->polls++;
+    for (int c = 0; d->busy >> c; c++) {
+        if (!(d->busy >> c & 1)) continue;
+        deb_vec t = d->timer[c] - ((deb_vec)(d->timer[c] != 0) & 1);
+        d->timer[c] = t;
+        uint64_t lanes[4];
+        memcpy(lanes, &t, sizeof(lanes));
+        if (!(lanes[0] | lanes[1] | lanes[2] | lanes[3])) d->busy &= ~(1 << c);
+    }
+    while (d->count && d->held[d->head].due <= d->polls) deb_deliver(d, cb, arg);
+}
+
+// delivers everything held: at end of input, and ahead of codes that
+// bypass the stage so they can't overtake a held press
+static inline void deb_flush(struct debounce* d, deb_cb cb, void* arg) {
+    while (d->count) deb_deliver(d, cb, arg);
+}
+
+// "eager[:polls]" or "deferred[:polls]", -1 if it is neither
+static inline int deb_parse(const char* arg, int* mode, unsigned* window) {
+    const char* colon = strchr(arg, ':');
+    size_t n = colon ? (size_t)(colon - arg) : strlen(arg);
+    if (n == 5 && !strncmp(arg, "eager", 5)) *mode = DEB_EAGER;
+    else if (n == 8 && !strncmp(arg, "deferred", 8)) *mode = DEB_DEFERRED;
+    else return -1;
+    *window = colon ? (unsigned)atoi(colon + 1) : DEB_WINDOW;
+    return *window >= 1 && *window <= 254 ? 0 : -1;
+}
+
+static inline void deb_print_stats(const struct debounce* d) {
+    fprintf(stderr, "\ndebounce (%s, %u polls): %lu presses passed, %lu suppressed\n",
+        d->mode == DEB_EAGER ? "eager" : "deferred", d->window, d->passed, d->suppressed);
+}
+
+#endif
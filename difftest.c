@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// Differential runner for the driver variants.
+//
+// Runs every input through each variant binary, normalizes what they print
+// and compares it with a golden output: the file <golden_dir>/<input>.golden
+// when -g is given and it exists (-u rewrites it), otherwise the first
+// variant's output. A golden file is a "leds <sequence>" line followed by
+// the normalized text.
+// Normalizing strips the banners some variants print and pulls out the LED
+// reports, which come as "ON "/"OFF " from the simulator's listener or as
+// "\nON\n"/"\nOFF\n" from the driver, so typed text and the LED sequence are
+// compared separately. Typed text containing capital "ON "/"OFF " would be
+// read as LED reports; keep the corpus free of it.
+//
+// Every variant makes its pipes and LED buffer before forking its driver,
+// so a run leaves nothing behind; a variant that outlives the timeout is
+// killed with its process group and reported as hung.
+
+#define MAX_VARIANTS 16
+#define MAX_OUTPUT   (16 << 20)
+#define MAX_LEDS     4096
+
+struct result {
+    int status;             // RUN_*
+    char* text;
+    char leds[MAX_LEDS];    // '1' ON, '0' OFF
+    int nleds;
+    double wall;
+    double first_output;
+    long keys;
+};
+
+#define RUN_OK      0
+#define RUN_HANG    1
+#define RUN_CRASH   2
+#define RUN_MISSING 3
+
+const char* status_name[] = { "ok", "hang", "crash", "missing" };
+
+const char* default_variants[] = { "./keyboard", "./keyboard-cpp", "./kbd", "./kbd1", "./kbd2" };
+
+double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void remove_all(char* s, const char* pat) {
+    size_t len = strlen(pat);
+    char* p;
+    while ((p = strstr(s, pat))) memmove(p, p + len, strlen(p + len) + 1);
+}
+
+// strips banners and LED reports out of raw output, in place
+void normalize(char* out, struct result* r) {
+    const char* banners[] = {
+        "Driver started. Listening to keyboard input...\n",
+        "\nDriver shutting down.\n",
+    };
+    for (int i = 0; i < 2; i++) remove_all(out, banners[i]);
+
+    // LED reports in order of appearance, whichever form they take
+    const char* leds[] = { "\nON\n", "\nOFF\n", "OFF ", "ON " };
+    char* w = out;
+    r->nleds = 0;
+    for (char* p = out; *p;) {
+        int hit = -1;
+        for (int i = 0; i < 4 && hit < 0; i++)
+            if (!strncmp(p, leds[i], strlen(leds[i]))) hit = i;
+        if (hit < 0) {
+            *w++ = *p++;
+            continue;
+        }
+        if (r->nleds < MAX_LEDS) r->leds[r->nleds++] = (hit == 0 || hit == 3) ? '1' : '0';
+        p += strlen(leds[hit]);
+    }
+    *w = 0;
+
+    // trailing whitespace varies with who prints the final newline
+    while (w > out && (w[-1] == '\n' || w[-1] == ' ')) *--w = 0;
+}
+
+void run_variant(const char* bin, const char* input, int timeout, struct result* r) {
+    memset(r, 0, sizeof(*r));
+    r->text = calloc(1, MAX_OUTPUT + 1);
+
+    // a variant is a binary, optionally followed by its own options
+    char cmd[1024];
+    char* args[32];
+    int nargs = 0;
+    snprintf(cmd, sizeof(cmd), "%s", bin);
+    for (char* tok = strtok(cmd, " "); tok && nargs < 30; tok = strtok(NULL, " ")) args[nargs++] = tok;
+    args[nargs++] = (char*)input;
+    args[nargs] = NULL;
+
+    if (access(args[0], X_OK) < 0) {
+        r->status = RUN_MISSING;
+        return;
+    }
+
+    struct stat st;
+    r->keys = stat(input, &st) == 0 ? st.st_size : 0;
+
+    int fds[2];
+    pipe(fds);
+    double start = now_sec();
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        setpgid(0, 0);
+        dup2(fds[1], 1);
+        close(fds[0]);
+        close(fds[1]);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, 2);
+        execv(args[0], args);
+        _exit(127);
+    }
+    setpgid(pid, pid);
+    close(fds[1]);
+
+    size_t len = 0;
+    r->first_output = -1;
+    while (1) {
+        int left = timeout * 1000 - (int)((now_sec() - start) * 1000);
+        if (left <= 0) {
+            r->status = RUN_HANG;
+            break;
+        }
+        struct pollfd pfd = { fds[0], POLLIN, 0 };
+        if (poll(&pfd, 1, left) <= 0) continue;
+
+        ssize_t n = read(fds[0], r->text + len, MAX_OUTPUT - len);
+        if (n <= 0) break;
+        if (r->first_output < 0) r->first_output = now_sec() - start;
+        len += n;
+    }
+    r->text[len] = 0;
+    close(fds[0]);
+
+    // the simulator may exit while its driver child hangs around
+    kill(-pid, SIGKILL);
+    int status;
+    waitpid(pid, &status, 0);
+    r->wall = now_sec() - start;
+
+    if (r->status != RUN_HANG && (!WIFEXITED(status) || WEXITSTATUS(status) != 0))
+        r->status = RUN_CRASH;
+
+    normalize(r->text, r);
+}
+
+void golden_path(const char* dir, const char* input, char* path, size_t size) {
+    const char* base = strrchr(input, '/');
+    snprintf(path, size, "%s/%s.golden", dir, base ? base + 1 : input);
+}
+
+int read_golden(const char* path, struct result* g) {
+    FILE* f = fopen(path, "r");
+    if (!f) return 0;
+
+    memset(g, 0, sizeof(*g));
+    g->text = calloc(1, MAX_OUTPUT + 1);
+    if (fscanf(f, "leds %4095[01]", g->leds) == 1) g->nleds = strlen(g->leds);
+    if (fgetc(f) != '\n') {
+        fclose(f);
+        return 0;
+    }
+    size_t n = fread(g->text, 1, MAX_OUTPUT, f);
+    g->text[n] = 0;
+    fclose(f);
+    return 1;
+}
+
+void write_golden(const char* path, struct result* g) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        perror("unable to write golden output");
+        return;
+    }
+    fprintf(f, "leds %.*s\n%s", g->nleds, g->leds, g->text);
+    fclose(f);
+    printf("  wrote %s\n", path);
+}
+
+// where two outputs part ways, for the report
+void show_diff(const char* want, const char* got) {
+    size_t i = 0;
+    while (want[i] && want[i] == got[i]) i++;
+    size_t from = i > 20 ? i - 20 : 0;
+    printf("      differs at byte %zu\n", i);
+    printf("      want \"%.40s\"\n", want + from);
+    printf("       got \"%.40s\"\n", got + from);
+}
+
+int main(int argc, char* argv[]) {
+    const char* variants[MAX_VARIANTS];
+    int nvariants = 0;
+    const char* golden_dir = NULL;
+    int update = 0;
+    int timeout = 10;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:g:ut:")) != -1) {
+        switch (opt) {
+        case 'b':
+            if (nvariants < MAX_VARIANTS) variants[nvariants++] = optarg;
+            break;
+        case 'g': golden_dir = optarg; break;
+        case 'u': update = 1; break;
+        case 't': timeout = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-b variant]... [-g golden_dir [-u]] [-t timeout_s] <input>...\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "%s: no inputs\n", argv[0]);
+        exit(1);
+    }
+    if (!nvariants) {
+        for (int i = 0; i < 5; i++) variants[i] = default_variants[i];
+        nvariants = 5;
+    }
+
+    int mismatches = 0;
+    for (int in = optind; in < argc; in++) {
+        const char* input = argv[in];
+        struct result res[MAX_VARIANTS];
+        char path[4096];
+
+        printf("Input: %s\n", input);
+        for (int v = 0; v < nvariants; v++) run_variant(variants[v], input, timeout, &res[v]);
+
+        // golden output: stored file, or the first variant that ran
+        struct result stored, *golden = NULL;
+        if (golden_dir) golden_path(golden_dir, input, path, sizeof(path));
+        if (golden_dir && !update && read_golden(path, &stored)) golden = &stored;
+        for (int v = 0; v < nvariants && !golden; v++) {
+            if (res[v].status != RUN_OK) continue;
+            golden = &res[v];
+            printf("  reference: %s\n", variants[v]);
+        }
+        if (golden && golden_dir && update) write_golden(path, golden);
+
+        printf("  %-24s %-8s %-6s %-6s %10s %12s %12s\n", "variant", "status", "text", "leds", "wall ms", "keys/sec", "first out ms");
+        for (int v = 0; v < nvariants; v++) {
+            struct result* r = &res[v];
+            int text_ok = golden && !strcmp(r->text, golden->text);
+            int leds_ok = golden && r->nleds == golden->nleds && !memcmp(r->leds, golden->leds, r->nleds);
+
+            if (r->status == RUN_MISSING) {
+                printf("  %-24s %-8s\n", variants[v], status_name[r->status]);
+                continue;
+            }
+            printf("  %-24s %-8s %-6s %-6s %10.1f %12.1f %12.1f\n", variants[v], status_name[r->status],
+                text_ok ? "same" : "DIFF", leds_ok ? "same" : "DIFF",
+                r->wall * 1e3, r->wall > 0 ? r->keys / r->wall : 0.0,
+                r->first_output < 0 ? -1.0 : r->first_output * 1e3);
+
+            if (golden && !text_ok) show_diff(golden->text, r->text);
+            if (golden && !leds_ok)
+                printf("      leds want %.*s got %.*s\n", golden->nleds, golden->leds, r->nleds, r->leds);
+            mismatches += r->status != RUN_OK || !text_ok || !leds_ok;
+        }
+    }
+
+    return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
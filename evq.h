@@ -0,0 +1,192 @@
+#ifndef EVQ_H
+#define EVQ_H
+
+// Bounded event queue between the interrupt endpoint reader and dispatch.
+//
+// With the queue in place the reader keeps draining the endpoint while
+// dispatch is stuck in an LED round trip, and what happens when dispatch
+// falls behind is an explicit policy rather than the kernel FIFO filling up
+// until the simulator's write blocks:
+//
+//     block      the reader waits for room, so backpressure reaches the
+//                simulator as before, only later
+//     drop       the oldest padding event (NO_EVENT) is thrown away to make
+//                room
+//     coalesce   every run of padding is squashed to a single event
+//
+// Real keys are never lost: when there is no padding left to drop or
+// squash, drop and coalesce block like block does. The counters say how
+// deep the queue got and what the policy had to do, for sizing it against
+// bursty input.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EVQ_BLOCK    0
+#define EVQ_DROP     1
+#define EVQ_COALESCE 2
+
+static const char* evq_policy_name[] = { "block", "drop", "coalesce" };
+
+struct evq {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+
+    char* buf;
+    unsigned size;
+    unsigned head;   // next pop
+    unsigned count;
+    int closed;
+
+    int policy;
+    char padding;
+
+    // counters
+    unsigned long pushed;
+    unsigned long dropped;
+    unsigned long coalesced;
+    unsigned long blocked;
+    unsigned high_water;
+};
+
+static inline void evq_init(struct evq* q, unsigned size, int policy, char padding) {
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+    q->buf = malloc(size);
+    if (!q->buf) {
+        perror("evq alloc failed");
+        exit(1);
+    }
+    q->size = size;
+    q->head = q->count = 0;
+    q->closed = 0;
+    q->policy = policy;
+    q->padding = padding;
+    q->pushed = q->dropped = q->coalesced = q->blocked = 0;
+    q->high_water = 0;
+}
+
+// "64" or "64:drop", returns -1 on a malformed spec
+static inline int evq_parse(const char* spec, unsigned* size, int* policy) {
+    char* end;
+    long n = strtol(spec, &end, 10);
+    if (n <= 0 || (*end && *end != ':')) return -1;
+    *size = n;
+    *policy = EVQ_BLOCK;
+    if (!*end) return 0;
+    for (int i = 0; i < 3; i++) {
+        if (!strcmp(end + 1, evq_policy_name[i])) {
+            *policy = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static inline char* evq_at(struct evq* q, unsigned i) {
+    return &q->buf[(q->head + i) % q->size];
+}
+
+// removes the i-th queued event, keeping the order of the rest
+static inline void evq_remove(struct evq* q, unsigned i) {
+    for (; i + 1 < q->count; i++) *evq_at(q, i) = *evq_at(q, i + 1);
+    q->count--;
+}
+
+// makes room without blocking under drop/coalesce: 1 if it did, -1 if ev
+// merged into the tail and needs no slot, 0 if the producer has to wait
+static inline int evq_make_room(struct evq* q, char ev) {
+    if (q->policy == EVQ_DROP) {
+        for (unsigned i = 0; i < q->count; i++) {
+            if (*evq_at(q, i) == q->padding) {
+                evq_remove(q, i);
+                q->dropped++;
+                return 1;
+            }
+        }
+    }
+    else if (q->policy == EVQ_COALESCE) {
+        int freed = 0;
+        for (unsigned i = 1; i < q->count;) {
+            if (*evq_at(q, i) == q->padding && *evq_at(q, i - 1) == q->padding) {
+                evq_remove(q, i);
+                q->coalesced++;
+                freed = 1;
+            }
+            else i++;
+        }
+        // padding arriving behind padding merges into it
+        if (!freed && ev == q->padding && q->count && *evq_at(q, q->count - 1) == q->padding) {
+            q->coalesced++;
+            return -1;
+        }
+        return freed;
+    }
+    return 0;
+}
+
+static inline void evq_push(struct evq* q, char ev) {
+    pthread_mutex_lock(&q->lock);
+    q->pushed++;
+    if (q->count == q->size) {
+        int room = evq_make_room(q, ev);
+        if (room < 0) {
+            pthread_mutex_unlock(&q->lock);
+            return;
+        }
+        if (!room) {
+            q->blocked++;
+            while (q->count == q->size) pthread_cond_wait(&q->not_full, &q->lock);
+        }
+    }
+    *evq_at(q, q->count++) = ev;
+    if (q->count > q->high_water) q->high_water = q->count;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// blocks for the next event, -1 once the queue is closed and drained
+static inline int evq_pop(struct evq* q) {
+    pthread_mutex_lock(&q->lock);
+    while (!q->count && !q->closed) pthread_cond_wait(&q->not_empty, &q->lock);
+    int ev = -1;
+    if (q->count) {
+        ev = (unsigned char)*evq_at(q, 0);
+        q->head = (q->head + 1) % q->size;
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ev;
+}
+
+// events waiting; a snapshot, the reader may push more right after
+static inline unsigned evq_count(struct evq* q) {
+    pthread_mutex_lock(&q->lock);
+    unsigned n = q->count;
+    pthread_mutex_unlock(&q->lock);
+    return n;
+}
+
+static inline int evq_empty(struct evq* q) {
+    return !evq_count(q);
+}
+
+static inline void evq_close(struct evq* q) {
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static inline void evq_print_stats(struct evq* q) {
+    fprintf(stderr, "\nint queue: depth %u (%s), high water %u, %lu pushed, %lu blocked, "
+        "%lu dropped, %lu coalesced\n",
+        q->size, evq_policy_name[q->policy], q->high_water, q->pushed, q->blocked, q->dropped, q->coalesced);
+}
+
+#endif
@@ -0,0 +1,738 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ucontext.h>
+
+// Deterministic schedule exploration for the deadlock tests.
+//
+// test.c provokes deadlocks with sleep() and catches them with alarm(5), so
+// every test costs seconds and only sees the interleavings the kernel happens
+// to pick. Here the same scenarios run as user-level threads (ucontext) on a
+// stand-in for the a6 device and a model of the keyboard driver's threads.
+// Every synchronization operation is a scheduling point, and the scheduler
+// decides which thread runs next, either walking every schedule depth-first
+// or picking at random from a seed. A wait-for cycle is reported as soon as
+// it forms, together with the schedule that produced it.
+
+#define MAX_THREADS 16
+#define MAX_STEPS   4096
+#define STACK_SIZE  (64 * 1024)
+#define CHAN_SIZE   256
+
+#define RES_MUTEX  0
+#define RES_SEM    1
+#define RES_CHAN   2
+#define RES_QUEUE  3
+#define RES_THREAD 4
+
+#define RUN_OK       0
+#define RUN_DEADLOCK 1
+#define RUN_HANG     2
+
+// something a thread can block on. holders is the set of threads that could
+// release it: the mutex owner, threads holding a semaphore unit, the open
+// write ends of a channel, the threads that may wake a wait queue
+struct res {
+    const char* name;
+    int kind;
+    int count;
+    unsigned holders;
+    char buf[CHAN_SIZE];
+    int head;
+};
+
+struct sthread {
+    ucontext_t ctx;
+    char* stack;
+    const char* name;
+    void (*fn)(void);
+    int done;
+
+    // pending operation, checked by the scheduler before resuming
+    struct res* waiting;
+    int (*pred)(void);
+    const char* op;
+
+    struct res exit_res;    // joined on
+};
+
+struct scenario {
+    const char* name;
+    void (*setup)(void);
+    int expect;
+};
+
+typedef struct res res;
+typedef struct sthread sthread;
+
+sthread threads[MAX_THREADS];
+int nthreads;
+int current = -1;
+ucontext_t sched_ctx;
+
+// schedule being explored: the choice taken at each step and how many
+// threads were enabled there
+int choice[MAX_STEPS];
+int nalt[MAX_STEPS];
+int prefix_len;
+int steps;
+int trace_tid[MAX_STEPS];
+const char* trace_op[MAX_STEPS];
+const char* trace_res[MAX_STEPS];
+
+unsigned seed;
+int random_mode = 0;
+int verbose = 0;
+
+void res_init(res* r, const char* name, int kind, int count) {
+    memset(r, 0, sizeof(*r));
+    r->name = name;
+    r->kind = kind;
+    r->count = count;
+}
+
+// SCHEDULING POINTS
+
+// park the current thread on an operation and hand control to the scheduler
+void sched_point(const char* op, res* r, int (*pred)(void)) {
+    sthread* t = &threads[current];
+    t->op = op;
+    t->waiting = r;
+    t->pred = pred;
+    swapcontext(&t->ctx, &sched_ctx);
+    t->waiting = NULL;
+    t->pred = NULL;
+}
+
+int enabled(int tid) {
+    sthread* t = &threads[tid];
+    res* r = t->waiting;
+
+    if (t->done) return 0;
+    if (t->pred) return t->pred();
+    if (!r) return 1;
+
+    switch (r->kind) {
+    case RES_MUTEX:  return r->holders == 0;
+    case RES_SEM:    return r->count > 0;
+    case RES_CHAN:   return r->count > 0 || r->holders == 0;
+    case RES_THREAD: return r->holders == 0;
+    }
+    return 1;
+}
+
+void sx_yield(const char* op) {
+    sched_point(op, NULL, NULL);
+}
+
+void sx_hold(res* r) {
+    r->holders |= 1u << current;
+}
+
+void sx_drop(res* r) {
+    r->holders &= ~(1u << current);
+}
+
+void sx_lock(res* m) {
+    sched_point("lock", m, NULL);
+    m->holders = 1u << current;
+}
+
+void sx_unlock(res* m) {
+    sched_point("unlock", NULL, NULL);
+    m->holders = 0;
+}
+
+void sx_down(res* s) {
+    sched_point("down", s, NULL);
+    s->count--;
+    sx_hold(s);
+}
+
+void sx_up(res* s) {
+    sched_point("up", NULL, NULL);
+    s->count++;
+    sx_drop(s);
+}
+
+// wait_event(): wakeups are modelled by re-checking the predicate
+void sx_wait(res* q, int (*pred)(void)) {
+    if (pred()) return;
+    sched_point("wait", q, pred);
+}
+
+void sx_write(res* c, char ch) {
+    sched_point("write", NULL, NULL);
+    if (c->count == CHAN_SIZE) {
+        fprintf(stderr, "explore: channel %s overflow\n", c->name);
+        exit(2);
+    }
+    c->buf[(c->head + c->count++) % CHAN_SIZE] = ch;
+}
+
+// returns 0 once the channel is empty and every write end is closed
+int sx_read(res* c, char* ch) {
+    sched_point("read", c, NULL);
+    if (c->count == 0) return 0;
+    *ch = c->buf[c->head];
+    c->head = (c->head + 1) % CHAN_SIZE;
+    c->count--;
+    return 1;
+}
+
+void thread_entry(void) {
+    sthread* t = &threads[current];
+    t->fn();
+    t->done = 1;
+    t->exit_res.holders = 0;
+    swapcontext(&t->ctx, &sched_ctx);
+}
+
+int sx_spawn(const char* name, void (*fn)(void)) {
+    if (nthreads == MAX_THREADS) {
+        fprintf(stderr, "explore: too many threads\n");
+        exit(2);
+    }
+
+    int tid = nthreads++;
+    sthread* t = &threads[tid];
+    if (!t->stack) t->stack = malloc(STACK_SIZE);
+
+    t->name = name;
+    t->fn = fn;
+    t->done = 0;
+    t->waiting = NULL;
+    t->pred = NULL;
+    t->op = "start";
+    res_init(&t->exit_res, name, RES_THREAD, 0);
+    t->exit_res.holders = 1u << tid;
+
+    getcontext(&t->ctx);
+    t->ctx.uc_stack.ss_sp = t->stack;
+    t->ctx.uc_stack.ss_size = STACK_SIZE;
+    t->ctx.uc_link = NULL;
+    makecontext(&t->ctx, thread_entry, 0);
+    return tid;
+}
+
+void sx_join(int tid) {
+    sched_point("join", &threads[tid].exit_res, NULL);
+}
+
+// WAIT-FOR GRAPH
+
+unsigned wait_edges(int tid) {
+    sthread* t = &threads[tid];
+    if (t->done || !t->waiting) return 0;
+    unsigned edges = t->waiting->holders;
+    if (t->waiting->kind == RES_QUEUE) edges &= ~(1u << tid);
+    return edges;
+}
+
+// threads that can never run again: not enabled, and nothing that could
+// release what they wait on can ever run either
+unsigned stuck_threads(void) {
+    unsigned live = 0, pending = 0;
+    for (int i = 0; i < nthreads; i++) {
+        if (threads[i].done) continue;
+        if (enabled(i)) live |= 1u << i;
+        else pending |= 1u << i;
+    }
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = 0; i < nthreads; i++) {
+            if (!(pending & (1u << i))) continue;
+            if (wait_edges(i) & live) {
+                live |= 1u << i;
+                pending &= ~(1u << i);
+                changed = 1;
+            }
+        }
+    }
+    return pending;
+}
+
+// first thread on a wait-for cycle among the stuck threads, or -1
+int find_cycle(unsigned stuck) {
+    for (unsigned todo = stuck; todo; todo &= todo - 1) {
+        int seen[MAX_THREADS];
+        memset(seen, 0, sizeof(seen));
+
+        int t = __builtin_ctz(todo);
+        while (t >= 0 && !seen[t]) {
+            seen[t] = 1;
+            unsigned next = wait_edges(t) & stuck;
+            t = next ? __builtin_ctz(next) : -1;
+        }
+        if (t >= 0) return t;
+    }
+    return -1;
+}
+
+void report_deadlock(unsigned stuck, int start) {
+    if (start < 0) {
+        printf("  blocked forever:");
+        for (int i = 0; i < nthreads; i++) {
+            if (!(stuck & (1u << i))) continue;
+            res* r = threads[i].waiting;
+            printf(" %s (%s %s)", threads[i].name, threads[i].op, r ? r->name : "?");
+        }
+        printf("\n");
+        return;
+    }
+
+    printf("  wait-for cycle:");
+    int t = start;
+    do {
+        res* r = threads[t].waiting;
+        printf(" %s -[%s %s]->", threads[t].name, threads[t].op, r->name);
+        t = __builtin_ctz(wait_edges(t) & stuck);
+    } while (t != start);
+    printf(" %s\n", threads[start].name);
+}
+
+void print_trace(void) {
+    printf("  schedule:");
+    for (int i = 0; i < steps; i++) {
+        printf(" %s:%s", threads[trace_tid[i]].name, trace_op[i]);
+        if (trace_res[i]) printf("(%s)", trace_res[i]);
+    }
+    printf("\n");
+}
+
+// SCHEDULER
+
+int pick(int n) {
+    if (random_mode) return rand_r(&seed) % n;
+    if (steps < prefix_len) return choice[steps];
+    return 0;
+}
+
+int run_schedule(const struct scenario* s) {
+    nthreads = 0;
+    steps = 0;
+    s->setup();
+
+    while (1) {
+        int en[MAX_THREADS], n = 0;
+        for (int i = 0; i < nthreads; i++)
+            if (enabled(i)) en[n++] = i;
+
+        // a cycle is reported the moment it closes, threads that are stuck
+        // for other reasons once nothing else can run
+        unsigned stuck = stuck_threads();
+        int cycle = stuck ? find_cycle(stuck) : -1;
+        if (cycle >= 0 || (stuck && n == 0)) {
+            if (verbose) print_trace();
+            report_deadlock(stuck, cycle);
+            return RUN_DEADLOCK;
+        }
+        if (n == 0) return RUN_OK;
+        if (steps == MAX_STEPS) {
+            if (verbose) print_trace();
+            printf("  no progress after %d steps\n", MAX_STEPS);
+            return RUN_HANG;
+        }
+
+        int c = pick(n);
+        choice[steps] = c;
+        nalt[steps] = n;
+
+        current = en[c];
+        sthread* t = &threads[current];
+        trace_tid[steps] = current;
+        trace_op[steps] = t->op;
+        trace_res[steps] = t->waiting ? t->waiting->name : NULL;
+        steps++;
+
+        swapcontext(&sched_ctx, &t->ctx);
+        current = -1;
+    }
+}
+
+// advance to the next unexplored schedule, 0 when the tree is exhausted
+int next_schedule(void) {
+    for (int k = steps - 1; k >= 0; k--) {
+        if (choice[k] + 1 < nalt[k]) {
+            choice[k]++;
+            prefix_len = k + 1;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// A6 STAND-IN
+// the e2 char driver from the assignment: sem1 guards the device state,
+// sem2 gives MODE1 its single opener, and switching to MODE1 waits on
+// queue1 until the caller is the only MODE2 opener left
+
+#define MODE1 1
+#define MODE2 2
+
+struct a6 {
+    int mode;
+    int count1;
+    int count2;
+    res sem1;
+    res sem2;
+    res queue1;
+} dev;
+
+void a6_init(void) {
+    dev.mode = MODE1;
+    dev.count1 = 0;
+    dev.count2 = 0;
+    res_init(&dev.sem1, "sem1", RES_SEM, 1);
+    res_init(&dev.sem2, "sem2", RES_SEM, 1);
+    res_init(&dev.queue1, "queue1", RES_QUEUE, 0);
+}
+
+void a6_open(void) {
+    sx_down(&dev.sem1);
+    sx_hold(&dev.queue1);
+    if (dev.mode == MODE1) {
+        dev.count1++;
+        sx_up(&dev.sem1);
+        sx_down(&dev.sem2);
+        return;
+    }
+    dev.count2++;
+    sx_up(&dev.sem1);
+}
+
+void a6_release(void) {
+    sx_down(&dev.sem1);
+    if (dev.mode == MODE1) {
+        dev.count1--;
+        sx_up(&dev.sem2);
+    }
+    else {
+        dev.count2--;
+    }
+    sx_drop(&dev.queue1);
+    sx_up(&dev.sem1);
+}
+
+void a6_io(void) {
+    sx_down(&dev.sem1);
+    sx_up(&dev.sem1);
+}
+
+int count2_is_one(void) {
+    return dev.count2 == 1;
+}
+
+void a6_ioctl(int mode) {
+    sx_down(&dev.sem1);
+    if (mode == MODE2 && dev.mode == MODE1) {
+        dev.mode = MODE2;
+        dev.count1--;
+        dev.count2++;
+        sx_up(&dev.sem2);
+    }
+    else if (mode == MODE1 && dev.mode == MODE2) {
+        while (dev.count2 > 1) {
+            sx_up(&dev.sem1);
+            sx_wait(&dev.queue1, count2_is_one);
+            sx_down(&dev.sem1);
+        }
+        dev.mode = MODE1;
+        dev.count2--;
+        dev.count1++;
+        sx_down(&dev.sem2);
+    }
+    sx_up(&dev.sem1);
+}
+
+// Test 1: opening at the same time in MODE1
+void t1_child(void) {
+    a6_open();
+    sx_yield("sleep");
+    a6_release();
+}
+
+void t1_parent(void) {
+    a6_open();
+    int child = sx_spawn("child", t1_child);
+    sx_yield("sleep");
+    a6_release();
+    sx_join(child);
+}
+
+void setup_simultaneous_open(void) {
+    a6_init();
+    sx_spawn("parent", t1_parent);
+}
+
+// Test 2: change mode while multiple processes have device open. test.c
+// relies on sleep(1) to get the child's open in before the switch back to
+// MODE1; when it isn't, the parent holds sem2 and waits for a child that is
+// blocked on sem2
+void t2_child(void) {
+    a6_open();
+    a6_io();
+    a6_release();
+}
+
+void t2_parent(void) {
+    a6_open();
+    a6_ioctl(MODE2);
+    int child = sx_spawn("child", t2_child);
+    a6_ioctl(MODE1);
+    sx_join(child);
+    a6_release();
+}
+
+void setup_mode_change_multiple_opens(void) {
+    a6_init();
+    sx_spawn("parent", t2_parent);
+}
+
+// Test 3: multiple read/write with multiple threads in MODE2
+void t3_worker(void) {
+    a6_open();
+    for (int i = 0; i < 2; i++) {
+        a6_io();
+        a6_io();
+    }
+    a6_release();
+}
+
+void t3_main(void) {
+    a6_open();
+    a6_ioctl(MODE2);
+    int w[3];
+    w[0] = sx_spawn("worker0", t3_worker);
+    w[1] = sx_spawn("worker1", t3_worker);
+    w[2] = sx_spawn("worker2", t3_worker);
+    for (int i = 0; i < 3; i++) sx_join(w[i]);
+    a6_ioctl(MODE1);
+    a6_release();
+}
+
+void setup_multi_io(void) {
+    a6_init();
+    sx_spawn("main", t3_main);
+}
+
+// Test 4: change mode during read/write, one open shared by both threads
+void t4_io(void) {
+    for (int i = 0; i < 3; i++) a6_io();
+}
+
+void t4_mode(void) {
+    a6_ioctl(MODE2);
+    a6_ioctl(MODE1);
+}
+
+void t4_main(void) {
+    a6_open();
+    int io = sx_spawn("io", t4_io);
+    int mode = sx_spawn("mode", t4_mode);
+    sx_join(io);
+    sx_join(mode);
+    a6_release();
+}
+
+void setup_mode_change_during_io(void) {
+    a6_init();
+    sx_spawn("main", t4_main);
+}
+
+// two MODE2 openers both switching back to MODE1: each waits for the other
+// to close, which never happens
+int two_openers(void) {
+    return dev.count2 == 2;
+}
+
+void t5_other(void) {
+    a6_open();
+    a6_ioctl(MODE1);
+    a6_release();
+}
+
+void t5_main(void) {
+    a6_open();
+    a6_ioctl(MODE2);
+    int other = sx_spawn("other", t5_other);
+    sx_wait(&dev.queue1, two_openers);
+    a6_ioctl(MODE1);
+    sx_join(other);
+    a6_release();
+}
+
+void setup_dual_mode1_switch(void) {
+    a6_init();
+    sx_spawn("main", t5_main);
+}
+
+// KEYBOARD DRIVER MODEL
+// the threads of keyboard.c and kbd.c with the FIFOs as channels
+
+#define NO_EVENT        '#'
+#define CAPSLOCK_PRESS  '@'
+#define CAPSLOCK_RELEASE '&'
+
+res int_pipe, ctrl_cmd_pipe, ctrl_ack_pipe, forever;
+const char* kbd_input = "a@b@&c";
+int listener_tid;
+
+void kbd_init(void) {
+    res_init(&int_pipe, "int_pipe", RES_CHAN, 0);
+    res_init(&ctrl_cmd_pipe, "ctrl_cmd_pipe", RES_CHAN, 0);
+    res_init(&ctrl_ack_pipe, "ctrl_ack_pipe", RES_CHAN, 0);
+    res_init(&forever, "sleep(1) loop", RES_QUEUE, 0);
+}
+
+void control_listener(void) {
+    sx_hold(&ctrl_ack_pipe);
+    char cmd;
+    while (sx_read(&ctrl_cmd_pipe, &cmd)) {
+        if (cmd == 'C') sx_write(&ctrl_ack_pipe, 'A');
+    }
+    sx_drop(&ctrl_ack_pipe);
+}
+
+void simulator(void) {
+    for (const char* p = kbd_input; *p; p++) sx_write(&int_pipe, *p);
+    sx_drop(&int_pipe);
+    sx_join(listener_tid);
+}
+
+// keyboard.c: the reader handles each key in order and does the capslock
+// LED round trip inline
+void keyboard_driver(void) {
+    char ch;
+    sx_hold(&ctrl_cmd_pipe);
+    while (sx_read(&int_pipe, &ch)) {
+        if (ch == CAPSLOCK_PRESS) {
+            sx_write(&ctrl_cmd_pipe, 'C');
+            sx_read(&ctrl_ack_pipe, &ch);
+        }
+    }
+    sx_drop(&ctrl_cmd_pipe);
+}
+
+void setup_keyboard_capslock(void) {
+    kbd_init();
+    listener_tid = sx_spawn("listener", control_listener);
+    int sim = sx_spawn("simulator", simulator);
+    int drv = sx_spawn("driver", keyboard_driver);
+    int_pipe.holders = 1u << sim;
+    ctrl_cmd_pipe.holders = 1u << drv;
+}
+
+// kbd.c: the irq URB stops at EOF but driver() sleeps forever with the
+// control endpoint open, so the listener never sees EOF
+void kbd_irq_urb(void) {
+    char ch;
+    while (sx_read(&int_pipe, &ch)) {
+        if (ch == CAPSLOCK_PRESS) {
+            sx_write(&ctrl_cmd_pipe, 'C');
+            sx_read(&ctrl_ack_pipe, &ch);
+        }
+    }
+}
+
+int never(void) {
+    return 0;
+}
+
+void kbd_driver(void) {
+    sx_hold(&ctrl_cmd_pipe);
+    int irq = sx_spawn("irq_urb", kbd_irq_urb);
+    sx_join(irq);
+    sx_wait(&forever, never);
+}
+
+void setup_kbd_shutdown(void) {
+    kbd_init();
+    listener_tid = sx_spawn("listener", control_listener);
+    int sim = sx_spawn("simulator", simulator);
+    int drv = sx_spawn("driver", kbd_driver);
+    int_pipe.holders = 1u << sim;
+    ctrl_cmd_pipe.holders = 1u << drv;
+}
+
+const struct scenario scenarios[] = {
+    { "Open simultaneously in MODE1", setup_simultaneous_open, RUN_OK },
+    { "Change mode with multiple open", setup_mode_change_multiple_opens, RUN_DEADLOCK },
+    { "Multi read/write with multi threads (MODE2)", setup_multi_io, RUN_OK },
+    { "Mode Change During I/O", setup_mode_change_during_io, RUN_OK },
+    { "Two MODE2 openers switch to MODE1", setup_dual_mode1_switch, RUN_DEADLOCK },
+    { "keyboard.c capslock round trips", setup_keyboard_capslock, RUN_OK },
+    { "kbd.c shutdown", setup_kbd_shutdown, RUN_DEADLOCK },
+};
+
+#define NSCENARIOS (int)(sizeof(scenarios) / sizeof(scenarios[0]))
+
+const char* outcome_name[] = { "ok", "deadlock", "hang" };
+
+// explores one scenario, returns 1 if it behaved as expected
+int explore(const struct scenario* s, int max_schedules) {
+    int counts[3] = { 0, 0, 0 };
+    int runs = 0, exhausted = 0;
+    int found = -1;
+
+    printf("Running scenario: %s\n", s->name);
+    prefix_len = 0;
+
+    while (runs < max_schedules) {
+        int r = run_schedule(s);
+        counts[r]++;
+        runs++;
+
+        // one report per scenario is enough, stop at the first surprise
+        if (r != RUN_OK) {
+            found = r;
+            break;
+        }
+
+        if (!random_mode && !next_schedule()) {
+            exhausted = 1;
+            break;
+        }
+    }
+
+    printf("  %d schedules%s, %d deadlocks, %d hangs\n", runs,
+        exhausted ? " (all)" : "", counts[RUN_DEADLOCK], counts[RUN_HANG]);
+
+    int result = found < 0 ? RUN_OK : found;
+    if (result != s->expect)
+        printf("  expected %s, got %s\n", outcome_name[s->expect], outcome_name[result]);
+    return result == s->expect;
+}
+
+int main(int argc, char* argv[]) {
+    int max_schedules = 10000;
+    const char* only = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:r:s:v")) != -1) {
+        switch (opt) {
+        case 'n': max_schedules = atoi(optarg); break;
+        case 'r': random_mode = 1; seed = strtoul(optarg, NULL, 0); break;
+        case 's': only = optarg; break;
+        case 'v': verbose = 1; break;
+        default:
+            fprintf(stderr, "Usage: %s [-n schedules] [-r seed] [-s scenario] [-v]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    printf("Deadlock schedule exploration:\n");
+
+    int failed = 0;
+    for (int i = 0; i < NSCENARIOS; i++) {
+        if (only && !strstr(scenarios[i].name, only)) continue;
+        int ok = explore(&scenarios[i], max_schedules);
+        printf(ok ? "Passed!\n" : "Failed :(\n");
+        failed += !ok;
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
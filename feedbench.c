@@ -0,0 +1,150 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+// Bulk feed throughput: moving an input file into the int_pipe endpoint
+// the way the simulator does (fgetc + one write() per key), with buffered
+// writes, with splice from the file, and with vmsplice from a mapping of
+// it (keyboard -b). The driver end drains the pipe with large reads and
+// counts bytes, so the difference between modes is the feeding side.
+// The corpus is written to a scratch file first and is read from the page
+// cache by every mode.
+
+#define CORPUS  "feed_corpus.tmp"
+#define CHUNK   65536
+
+double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void make_corpus(size_t size) {
+    int fd = open(CORPUS, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (fd < 0) {
+        perror("unable to create corpus");
+        exit(1);
+    }
+    char buf[CHUNK];
+    for (int i = 0; i < CHUNK; i++) buf[i] = i % 50 == 49 ? '@' : 'a' + i % 26;
+    for (size_t done = 0; done < size; done += CHUNK) write(fd, buf, size - done < CHUNK ? size - done : CHUNK);
+    close(fd);
+}
+
+void feed_perkey(int in, int out, size_t size) {
+    FILE* file = fdopen(dup(in), "r");
+    int ch;
+    for (size_t i = 0; i < size && (ch = fgetc(file)) != EOF; i++) {
+        char c = ch;
+        write(out, &c, 1);
+    }
+    fclose(file);
+}
+
+void feed_write(int in, int out, size_t size) {
+    static char buf[CHUNK];
+    ssize_t n;
+    for (size_t done = 0; done < size && (n = read(in, buf, sizeof(buf))) > 0; done += n)
+        for (ssize_t w = 0; w < n;) {
+            ssize_t r = write(out, buf + w, n - w);
+            if (r < 0) {
+                if (errno == EINTR) continue;
+                perror("write failed");
+                exit(1);
+            }
+            w += r;
+        }
+}
+
+void feed_splice(int in, int out, size_t size) {
+    loff_t off = 0;
+    while ((size_t)off < size) {
+        ssize_t n = splice(in, &off, out, NULL, size - off, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n <= 0) {
+            perror("splice failed");
+            exit(1);
+        }
+    }
+}
+
+void feed_vmsplice(int in, int out, size_t size) {
+    char* data = mmap(0, size, PROT_READ, MAP_PRIVATE, in, 0);
+    if (data == MAP_FAILED) {
+        perror("mmap corpus failed");
+        exit(1);
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+    for (size_t done = 0; done < size;) {
+        struct iovec iov = { data + done, size - done };
+        ssize_t n = vmsplice(out, &iov, 1, 0);
+        if (n <= 0) {
+            perror("vmsplice failed");
+            exit(1);
+        }
+        done += n;
+    }
+    munmap(data, size);
+}
+
+struct mode {
+    const char* name;
+    void (*feed)(int in, int out, size_t size);
+    int slow;   // per-key: run on a slice of the corpus
+};
+
+void run(struct mode* m, size_t size) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("pipe failed");
+        exit(1);
+    }
+    long* got = mmap(0, sizeof(long), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    double start = now_sec();
+    pid_t pid = fork();
+    if (pid == 0) {
+        static char buf[CHUNK];
+        long n = 0;
+        ssize_t r;
+        close(fds[1]);
+        while ((r = read(fds[0], buf, sizeof(buf))) > 0) n += r;
+        *got = n;
+        _exit(0);
+    }
+    close(fds[0]);
+
+    int in = open(CORPUS, O_RDONLY);
+    m->feed(in, fds[1], size);
+    close(in);
+    close(fds[1]);
+    waitpid(pid, NULL, 0);
+    double secs = now_sec() - start;
+
+    printf("  %-10s %10ld bytes in %8.3fs = %7.3f GB/s\n", m->name, *got, secs, *got / secs / 1e9);
+    munmap(got, sizeof(long));
+}
+
+int main(int argc, char* argv[]) {
+    size_t size = (argc > 1 ? atol(argv[1]) : 256) << 20;
+    struct mode modes[] = {
+        { "per-key", feed_perkey, 1 },
+        { "write", feed_write, 0 },
+        { "splice", feed_splice, 0 },
+        { "vmsplice", feed_vmsplice, 0 },
+    };
+
+    make_corpus(size);
+    printf("%zu MB corpus into a pipe (per-key on 1/64 of it)\n", size >> 20);
+    for (int i = 0; i < 4; i++) run(&modes[i], modes[i].slow ? size / 64 : size);
+    unlink(CORPUS);
+    return 0;
+}
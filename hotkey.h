@@ -0,0 +1,251 @@
+#ifndef HOTKEY_H
+#define HOTKEY_H
+
+// Hotkey matcher: recognizes configured key sequences in the stream of
+// delivered keys, Aho-Corasick style.
+//
+// The patterns are compiled into a trie and then into a full DFA: every
+// state has a transition for every key class, with the failure links
+// already followed at build time. So matching is one table load per key
+// however many patterns there are. Keys no pattern uses share class 0,
+// and the table is only as wide as the keys that do appear. Each state
+// records the patterns ending in it and the nearest proper suffix state
+// that ends some pattern too. A key that completes anything walks that
+// chain and tells each subscriber; other keys cost the load and one test.
+//
+// Config: one hotkey per line, "name: keys", where keys is the rest of the
+// line in the endpoint's format (capslock press is '@'). Blank lines and
+// lines starting with '#' are skipped.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HK_MAX_SUBS  8
+#define HK_MAX_LINE  1024
+
+// pattern p matched, ending at the key just fed
+typedef void (*hk_cb)(int pattern, const char* name, void* arg);
+
+struct hotkeys {
+    // patterns, as added
+    char** names;
+    char** keys;
+    int* same;              // next pattern with the same keys, -1
+    int npatterns, pcap;
+
+    // DFA
+    uint8_t cls[256];       // key to class, 0 for keys no pattern has
+    int nclass;
+    uint32_t* next;         // nstates * nclass
+    int32_t* out;           // first pattern ending at the state, -1
+    uint32_t* dict;         // nearest proper suffix state with output, 0
+    uint32_t* hit;          // the state itself if it has output, else dict
+    uint32_t nstates, scap;
+    uint32_t state;
+
+    struct {
+        hk_cb cb;
+        void* arg;
+    } subs[HK_MAX_SUBS];
+    int nsubs;
+
+    // counters
+    unsigned long fed;
+    unsigned long matches;
+};
+
+static inline void hk_init(struct hotkeys* h) {
+    memset(h, 0, sizeof(*h));
+}
+
+static inline void* hk_alloc(void* p, size_t size) {
+    p = realloc(p, size);
+    if (!p) {
+        perror("hotkeys: out of memory");
+        exit(1);
+    }
+    return p;
+}
+
+static inline void hk_add(struct hotkeys* h, const char* name, const char* keys) {
+    if (!*keys) return;
+    if (h->npatterns == h->pcap) {
+        h->pcap = h->pcap ? 2 * h->pcap : 64;
+        h->names = hk_alloc(h->names, h->pcap * sizeof(char*));
+        h->keys = hk_alloc(h->keys, h->pcap * sizeof(char*));
+        h->same = hk_alloc(h->same, h->pcap * sizeof(int));
+    }
+    h->names[h->npatterns] = strdup(name);
+    h->keys[h->npatterns] = strdup(keys);
+    h->same[h->npatterns] = -1;
+    h->npatterns++;
+}
+
+static inline uint32_t hk_new_state(struct hotkeys* h) {
+    if (h->nstates == h->scap) {
+        h->scap = h->scap ? 2 * h->scap : 1024;
+        h->next = hk_alloc(h->next, (size_t)h->scap * h->nclass * sizeof(uint32_t));
+        h->out = hk_alloc(h->out, h->scap * sizeof(int32_t));
+        h->dict = hk_alloc(h->dict, h->scap * sizeof(uint32_t));
+        h->hit = hk_alloc(h->hit, h->scap * sizeof(uint32_t));
+    }
+    uint32_t s = h->nstates++;
+    memset(h->next + (size_t)s * h->nclass, 0, h->nclass * sizeof(uint32_t));
+    h->out[s] = -1;
+    h->dict[s] = 0;
+    return s;
+}
+
+// builds the DFA from the patterns added so far
+static inline void hk_compile(struct hotkeys* h) {
+    memset(h->cls, 0, sizeof(h->cls));
+    h->nclass = 1;
+    for (int p = 0; p < h->npatterns; p++)
+        for (const unsigned char* k = (const unsigned char*)h->keys[p]; *k; k++)
+            if (!h->cls[*k]) h->cls[*k] = h->nclass++;
+
+    for (int p = 0; p < h->npatterns; p++) h->same[p] = -1;
+
+    // rows are nclass wide, so a recompile starts the table over
+    free(h->next);
+    h->next = NULL;
+    h->scap = h->nstates = 0;
+    h->state = 0;
+    hk_new_state(h);
+
+    // trie; state 0 is the root, so 0 in a trie slot means no child yet
+    for (int p = 0; p < h->npatterns; p++) {
+        uint32_t s = 0;
+        for (const unsigned char* k = (const unsigned char*)h->keys[p]; *k; k++) {
+            size_t slot = (size_t)s * h->nclass + h->cls[*k];
+            if (!h->next[slot]) {
+                uint32_t child = hk_new_state(h);
+                h->next[slot] = child;
+            }
+            s = h->next[slot];
+        }
+        // patterns with the same keys share the state, chained
+        if (h->out[s] < 0) h->out[s] = p;
+        else {
+            int q = h->out[s];
+            while (h->same[q] >= 0) q = h->same[q];
+            h->same[q] = p;
+        }
+    }
+
+    // breadth first: a state's failure state is shallower, so its row is
+    // already final and missing transitions can be copied from it
+    uint32_t* queue = hk_alloc(NULL, h->nstates * sizeof(uint32_t));
+    uint32_t* fail = hk_alloc(NULL, h->nstates * sizeof(uint32_t));
+    uint32_t head = 0, tail = 0;
+    for (int c = 0; c < h->nclass; c++) {
+        uint32_t child = h->next[c];
+        if (child) {
+            fail[child] = 0;
+            queue[tail++] = child;
+        }
+    }
+    while (head < tail) {
+        uint32_t s = queue[head++];
+        uint32_t f = fail[s];
+        h->dict[s] = h->out[f] >= 0 ? f : h->dict[f];
+        uint32_t* row = h->next + (size_t)s * h->nclass;
+        const uint32_t* frow = h->next + (size_t)f * h->nclass;
+        for (int c = 0; c < h->nclass; c++) {
+            if (row[c]) {
+                fail[row[c]] = frow[c];
+                queue[tail++] = row[c];
+            }
+            else row[c] = frow[c];
+        }
+    }
+
+    // renumber in breadth-first order: the shallow states, where almost
+    // every key lands, then share the first few pages of the table
+    uint32_t* id = fail;
+    id[0] = 0;
+    for (uint32_t i = 0; i < tail; i++) id[queue[i]] = i + 1;
+    uint32_t* next = hk_alloc(NULL, (size_t)h->scap * h->nclass * sizeof(uint32_t));
+    int32_t* out = hk_alloc(NULL, h->scap * sizeof(int32_t));
+    for (uint32_t s = 0; s < h->nstates; s++) {
+        const uint32_t* row = h->next + (size_t)s * h->nclass;
+        uint32_t* to = next + (size_t)id[s] * h->nclass;
+        for (int c = 0; c < h->nclass; c++) to[c] = id[row[c]];
+        out[id[s]] = h->out[s];
+        h->hit[id[s]] = id[h->dict[s]];
+    }
+    free(h->next);
+    free(h->out);
+    h->next = next;
+    h->out = out;
+    memcpy(h->dict, h->hit, h->nstates * sizeof(uint32_t));
+    for (uint32_t s = 0; s < h->nstates; s++) h->hit[s] = h->out[s] >= 0 ? s : h->dict[s];
+    free(queue);
+    free(fail);
+}
+
+// reads "name: keys" lines; -1 if the file can't be read
+static inline int hk_load(struct hotkeys* h, const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+    char line[HK_MAX_LINE];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = 0;
+        char* colon = strchr(line, ':');
+        if (line[0] == '#' || !colon) continue;
+        *colon = 0;
+        char* keys = colon + 1;
+        while (*keys == ' ') keys++;
+        hk_add(h, line, keys);
+    }
+    fclose(f);
+    hk_compile(h);
+    return 0;
+}
+
+static inline void hk_subscribe(struct hotkeys* h, hk_cb cb, void* arg) {
+    if (h->nsubs < HK_MAX_SUBS) {
+        h->subs[h->nsubs].cb = cb;
+        h->subs[h->nsubs].arg = arg;
+        h->nsubs++;
+    }
+}
+
+static inline void hk_emit(struct hotkeys* h, uint32_t s) {
+    for (; s; s = h->dict[s]) {
+        for (int p = h->out[s]; p >= 0; p = h->same[p]) {
+            h->matches++;
+            for (int i = 0; i < h->nsubs; i++) h->subs[i].cb(p, h->names[p], h->subs[i].arg);
+        }
+    }
+}
+
+// one delivered key
+static inline void hk_feed(struct hotkeys* h, char ch) {
+    h->fed++;
+    h->state = h->next[(size_t)h->state * h->nclass + h->cls[(unsigned char)ch]];
+    if (h->hit[h->state]) hk_emit(h, h->hit[h->state]);
+}
+
+static inline void hk_free(struct hotkeys* h) {
+    for (int p = 0; p < h->npatterns; p++) {
+        free(h->names[p]);
+        free(h->keys[p]);
+    }
+    free(h->names);
+    free(h->keys);
+    free(h->same);
+    free(h->next);
+    free(h->out);
+    free(h->dict);
+    free(h->hit);
+}
+
+static inline void hk_print_stats(const struct hotkeys* h) {
+    fprintf(stderr, "\nhotkeys: %d patterns, %u states x %d key classes, %lu keys, %lu matches\n",
+        h->npatterns, h->nstates, h->nclass, h->fed, h->matches);
+}
+
+#endif
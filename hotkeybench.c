@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+#include "hotkey.h"
+
+// Hotkey matcher benchmark (hotkey.h).
+//
+// Compiles 10, 100, ... up to -n random key sequences and runs the same
+// random key stream through each, reporting build time, table size and
+// ns/key. The cost per key should stay flat as the pattern count grows;
+// only the table (and so the cache misses) gets bigger, plus the callbacks
+// for what matches. Sets of up to 100 patterns are also matched naively
+// and the match counts compared.
+
+#define MIN_LEN 4
+#define MAX_LEN 8
+
+double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+uint32_t rng = 1;
+
+uint32_t next_rand() {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+char random_key() {
+    return 'a' + next_rand() % 26;
+}
+
+void on_match(int pattern, const char* name, void* arg) {
+    ++*(unsigned long*)arg;
+}
+
+unsigned long naive(char** pats, int n, const char* text, size_t len) {
+    unsigned long found = 0;
+    for (size_t i = 0; i < len; i++)
+        for (int p = 0; p < n; p++) {
+            size_t l = strlen(pats[p]);
+            if (i + 1 >= l && !memcmp(text + i + 1 - l, pats[p], l)) found++;
+        }
+    return found;
+}
+
+int main(int argc, char* argv[]) {
+    int max = 100000;
+    size_t len = 16 << 20;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:k:")) != -1) {
+        switch (opt) {
+        case 'n': max = atoi(optarg); break;
+        case 'k': len = (size_t)atol(optarg) << 20; break;
+        default:
+            fprintf(stderr, "Usage: %s [-n max_patterns] [-k stream_mkeys]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    char* text = malloc(len);
+    for (size_t i = 0; i < len; i++) text[i] = random_key();
+
+    char** pats = malloc(max * sizeof(char*));
+    for (int p = 0; p < max; p++) {
+        int l = MIN_LEN + next_rand() % (MAX_LEN - MIN_LEN + 1);
+        pats[p] = malloc(l + 1);
+        for (int i = 0; i < l; i++) pats[p][i] = random_key();
+        pats[p][l] = 0;
+    }
+
+    printf("%zu M keys, patterns of %d-%d keys\n", len >> 20, MIN_LEN, MAX_LEN);
+    printf("  %8s %9s %8s %9s %9s %12s\n", "patterns", "build ms", "states", "table MB", "ns/key", "matches");
+    int ok = 1;
+    for (int n = 10; n <= max; n = n * 10 > max && n < max ? max : n * 10) {
+        struct hotkeys h;
+        unsigned long matches = 0;
+        char name[16];
+
+        hk_init(&h);
+        double start = now_sec();
+        for (int p = 0; p < n; p++) {
+            snprintf(name, sizeof(name), "p%d", p);
+            hk_add(&h, name, pats[p]);
+        }
+        hk_compile(&h);
+        double build = now_sec() - start;
+        hk_subscribe(&h, on_match, &matches);
+
+        start = now_sec();
+        for (size_t i = 0; i < len; i++) hk_feed(&h, text[i]);
+        double secs = now_sec() - start;
+
+        printf("  %8d %9.1f %8u %9.1f %9.2f %12lu\n", n, build * 1e3, h.nstates,
+            (double)h.nstates * h.nclass * sizeof(uint32_t) / (1 << 20), secs * 1e9 / len, matches);
+
+        if (n <= 100) {
+            size_t check = len < (1 << 20) ? len : 1 << 20;
+            unsigned long want = naive(pats, n, text, check), got = 0;
+            struct hotkeys c;
+            hk_init(&c);
+            for (int p = 0; p < n; p++) hk_add(&c, "", pats[p]);
+            hk_compile(&c);
+            hk_subscribe(&c, on_match, &got);
+            for (size_t i = 0; i < check; i++) hk_feed(&c, text[i]);
+            if (got != want) {
+                printf("  MISMATCH: %lu matches, naive scan found %lu\n", got, want);
+                ok = 0;
+            }
+            hk_free(&c);
+        }
+        hk_free(&h);
+        if (n == max) break;
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -10,7 +10,6 @@
 #include <sys/wait.h>
 
 #define LED_BUF_SIZE 1
-#define SHM_NAME "/led_shm"
 
 #define NO_EVENT        '#'
 #define CAPSLOCK_PRESS  '@'
@@ -49,13 +48,21 @@ struct usb_kbd {
     int ctrl_ack_fd;   // for reading ACKs
 
     unsigned char* leds;
-    pthread_mutex_t leds_lock;
 
     // URBs for the endpoints
     struct urb* int_urb;
     struct urb* led_urb;
 };
 
+// Endpoints: pipes made before the fork, so the driver inherits them and
+// no two runs share a name. [0] reads, [1] writes.
+int int_pipe[2];        // keys, simulator to driver
+int ctrl_cmd_pipe[2];   // LED commands, driver to listener
+int ctrl_ack_pipe[2];   // acks, listener to driver
+
+// LED buffer, an anonymous MAP_SHARED mapping inherited the same way
+unsigned char* shared_leds;
+
 // Global variables
 usb_kbd kbd;
 int capslock_state = 0;
@@ -163,10 +170,9 @@ void usb_kbd_event(struct input_dev* dev_ptr) {
         capslock_state = 0;
     }
 
-    // Write new LED state to shared memory with lock protection
-    pthread_mutex_lock(&kbd.leds_lock);
-    *(kbd.leds) = dev_ptr->led ? LED_ON : LED_OFF;
-    pthread_mutex_unlock(&kbd.leds_lock);
+    // Write new LED state to shared memory; one byte, stored atomically, so
+    // it needs no lock
+    __atomic_store_n(kbd.leds, dev_ptr->led ? LED_ON : LED_OFF, __ATOMIC_RELEASE);
 
     // Submit the LED URB to handle the LED state change
     usb_submit_urb(kbd.led_urb);
@@ -182,34 +188,11 @@ int usb_kbd_open(void) {
     dev->led = LED_OFF;
     kbd.dev = dev;
 
-    // Initialize the mutex
-    pthread_mutex_init(&kbd.leds_lock, NULL);
-
-    // Open the pipes
-    kbd.int_ep_fd = open("int_pipe", O_RDONLY);
-    kbd.ctrl_cmd_fd = open("ctrl_cmd_pipe", O_WRONLY);
-    kbd.ctrl_ack_fd = open("ctrl_ack_pipe", O_RDONLY);
-
-    if (kbd.int_ep_fd < 0 || kbd.ctrl_cmd_fd < 0 || kbd.ctrl_ack_fd < 0) {
-        perror("pipe open failed");
-        free(dev);
-        return -1;
-    }
-
-    // Set up shared memory for LED buffer
-    int shm_fd = shm_open(SHM_NAME, O_RDWR, 0666);
-    if (shm_fd == -1) {
-        perror("shm_open failed");
-        free(dev);
-        return -1;
-    }
-
-    kbd.leds = mmap(0, LED_BUF_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    if (kbd.leds == MAP_FAILED) {
-        perror("mmap failed");
-        free(dev);
-        return -1;
-    }
+    // The driver's ends of the pipes, and the LED buffer
+    kbd.int_ep_fd = int_pipe[0];
+    kbd.ctrl_cmd_fd = ctrl_cmd_pipe[1];
+    kbd.ctrl_ack_fd = ctrl_ack_pipe[0];
+    kbd.leds = shared_leds;
 
     // Create URBs
     kbd.int_urb = malloc(sizeof(urb));
@@ -258,20 +241,15 @@ void* control_listener(void* arg) {
     unsigned char* leds = (unsigned char*)arg;
     int prev_state = LED_OFF;
 
-    int ctrl_cmd_fd = open("ctrl_cmd_pipe", O_RDONLY);
-    int ctrl_ack_fd = open("ctrl_ack_pipe", O_WRONLY);
-
-    if (ctrl_cmd_fd < 0 || ctrl_ack_fd < 0) {
-        perror("keyboard: control pipe open failed");
-        exit(1);
-    }
+    int ctrl_cmd_fd = ctrl_cmd_pipe[0];
+    int ctrl_ack_fd = ctrl_ack_pipe[1];
 
     while (1) {
         char cmd;
         if (read(ctrl_cmd_fd, &cmd, 1) <= 0) break;
 
         if (cmd == 'C') {
-            int curr = *leds;
+            int curr = __atomic_load_n(leds, __ATOMIC_ACQUIRE);
             if (curr != prev_state) {
                 if (curr == LED_ON) printf("ON ");
                 else printf("OFF ");
@@ -294,31 +272,36 @@ int main(int argc, char* argv[]) {
     }
 
     // Create pipes (simulate endpoints)
-    mkfifo("int_pipe", 0666);
-    mkfifo("ctrl_cmd_pipe", 0666);
-    mkfifo("ctrl_ack_pipe", 0666);
-
-    // Fork to create driver and keyboard processes
-    pid_t pid = fork();
-    if (pid < 0) return -1;
-    if (pid == 0) return driver();
-
-    int int_pipe_fd = open("int_pipe", O_WRONLY);
-    if (int_pipe_fd < 0) {
-        perror("keyboard: can't open int_pipe");
+    if (pipe(int_pipe) < 0 || pipe(ctrl_cmd_pipe) < 0 || pipe(ctrl_ack_pipe) < 0) {
+        perror("keyboard: pipe failed");
         exit(1);
     }
 
-    // Create shared memory for LED buffer
-    int shm_fd = shm_open(SHM_NAME, O_CREAT | O_RDWR, 0666);
-    ftruncate(shm_fd, LED_BUF_SIZE);
-    unsigned char* leds = mmap(0, LED_BUF_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    // Shared memory for LED buffer
+    unsigned char* leds = mmap(0, LED_BUF_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
     if (leds == MAP_FAILED) {
         perror("keyboard: mmap failed");
         exit(1);
     }
 
     *leds = LED_OFF; // Initially OFF
+    shared_leds = leds;
+
+    // Fork to create driver and keyboard processes; each closes the
+    // other's ends
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        close(int_pipe[1]);
+        close(ctrl_cmd_pipe[0]);
+        close(ctrl_ack_pipe[1]);
+        return driver();
+    }
+
+    close(int_pipe[0]);
+    close(ctrl_cmd_pipe[1]);
+    close(ctrl_ack_pipe[0]);
+    int int_pipe_fd = int_pipe[1];
 
     // Start LED control listener thread
     pthread_t ctrl_thread;
@@ -342,11 +325,6 @@ int main(int argc, char* argv[]) {
     pthread_join(ctrl_thread, NULL);
 
     munmap(leds, LED_BUF_SIZE);
-    shm_unlink(SHM_NAME);
-
-    unlink("int_pipe");
-    unlink("ctrl_cmd_pipe");
-    unlink("ctrl_ack_pipe");
 
     return 0;
 }
\ No newline at end of file
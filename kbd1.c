@@ -2,21 +2,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <fcntl.h>
 #include <string.h>
 #include <sys/mman.h>
-#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
 
 #define LED_BUF_SIZE 1
-#define SHM_NAME "/led_shm"
-#define TERMINATE_SHM "/terminate_shm"
 
 #define NO_EVENT        '#'
 #define CAPSLOCK_PRESS  '@'
 #define CAPSLOCK_RELEASE '&'
+#define END_OF_INPUT    '\x04'  // EOT, sent after the last key
 
 #define LED_ON  1
 #define LED_OFF 0
@@ -38,11 +37,27 @@ struct input_dev {
 
 struct urb {
     int endpoint_type;  // 0 for interrupt, 1 for control
-    pthread_t thread;
-    int active;
+    struct urb_worker* worker;  // endpoint thread that completes it
+    atomic_int active;  // set by the submitter, cleared by the handler
     void *context;
 };
 
+// Long-lived completion thread of one endpoint. Submitting an URB queues it
+// here and the thread runs its handler, so resubmitting after every key is
+// a queue push rather than a new thread.
+#define URB_QUEUE_SIZE 4
+
+struct urb_worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    urb* queue[URB_QUEUE_SIZE];
+    int head, tail;     // head - tail URBs queued
+    int closed;
+    void* (*handler)(void* arg);
+    long completions;
+};
+
 struct usb_kbd {
     struct input_dev* dev;
 
@@ -52,17 +67,36 @@ struct usb_kbd {
 
     unsigned char* leds;
     unsigned char* terminate_flag;  // Points to shared memory for termination flag
-    pthread_mutex_t leds_lock;
     
     // URBs for the endpoints
     struct urb* int_urb;
     struct urb* led_urb;
+    struct urb_worker int_worker;
+    struct urb_worker led_worker;
 };
 
+// Endpoints, created before fork and inherited by the driver: [0] is the
+// read end, [1] the write end. Nothing is named, so any number of replays
+// can run side by side in one directory.
+int int_pipe[2];        // simulator -> driver
+int ctrl_cmd_pipe[2];   // driver -> control listener
+int ctrl_ack_pipe[2];   // control listener -> driver
+
+// anonymous shared mappings, also inherited
+unsigned char* shared_leds;
+unsigned char* shared_terminate_flag;
+
+// setup timing: main() start to the driver's endpoints being submitted
+struct timespec start_time;
+
+// -v: setup time and completion counts on stderr
+int driver_stats = 0;
+
 // Global variables
 usb_kbd kbd;
 int capslock_state = 0;
-volatile int should_terminate = 0;  // Flag to indicate termination
+atomic_int should_terminate = 0;  // Flag to indicate termination, set from any URB thread
+atomic_long urb_threads_created = 0;
 
 // Function prototypes
 void usb_submit_urb(urb* urb);
@@ -83,19 +117,72 @@ void print_char(char ch) {
     fflush(stdout);
 }
 
+// Runs the handler of every URB submitted to the endpoint until it is closed
+void* urb_worker_thread(void* arg) {
+    struct urb_worker* w = (struct urb_worker*)arg;
+
+    pthread_mutex_lock(&w->lock);
+    while (1) {
+        while (w->head == w->tail && !w->closed)
+            pthread_cond_wait(&w->cond, &w->lock);
+        if (w->head == w->tail) break;
+
+        urb* urb = w->queue[w->tail++ % URB_QUEUE_SIZE];
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+
+        w->handler(urb);
+
+        pthread_mutex_lock(&w->lock);
+        w->completions++;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+int urb_worker_start(struct urb_worker* w, void* (*handler)(void* arg)) {
+    w->head = w->tail = 0;
+    w->closed = 0;
+    w->completions = 0;
+    w->handler = handler;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+
+    if (pthread_create(&w->thread, NULL, urb_worker_thread, w) != 0) {
+        perror("Failed to start URB worker");
+        return -1;
+    }
+    urb_threads_created++;
+    return 0;
+}
+
+// Lets the worker drain what is queued, then joins it
+void urb_worker_stop(struct urb_worker* w) {
+    pthread_mutex_lock(&w->lock);
+    w->closed = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_join(w->thread, NULL);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+}
+
 // Submit an URB (Universal Request Block) to start or continue endpoint handling
 void usb_submit_urb(urb* urb) {
-    if (!urb || urb->active || should_terminate) return;
-    
-    urb->active = 1;
-    
-    if (urb->endpoint_type == 0) { // Interrupt endpoint
-        pthread_create(&urb->thread, NULL, usb_kbd_irq, urb);
-    } else { // Control endpoint
-        pthread_create(&urb->thread, NULL, usb_kbd_led, urb);
+    // the handler clears active, so claim it atomically: only one submitter
+    // may queue the next completion
+    if (!urb || should_terminate || atomic_exchange(&urb->active, 1)) return;
+
+    struct urb_worker* w = urb->worker;
+    pthread_mutex_lock(&w->lock);
+    while (w->head - w->tail == URB_QUEUE_SIZE && !w->closed)
+        pthread_cond_wait(&w->cond, &w->lock);
+    if (!w->closed) {
+        w->queue[w->head++ % URB_QUEUE_SIZE] = urb;
+        pthread_cond_broadcast(&w->cond);
     }
-    
-    pthread_detach(urb->thread);
+    pthread_mutex_unlock(&w->lock);
 }
 
 // Interrupt endpoint handler - processes key events
@@ -182,10 +269,8 @@ void usb_kbd_event(struct input_dev* dev_ptr) {
         capslock_state = 0;
     }
 
-    // Write new LED state to shared memory with lock protection
-    pthread_mutex_lock(&kbd.leds_lock);
-    *(kbd.leds) = dev_ptr->led ? LED_ON : LED_OFF;
-    pthread_mutex_unlock(&kbd.leds_lock);
+    // Write new LED state to shared memory (same store as keyboard.c)
+    __atomic_store_n(kbd.leds, dev_ptr->led ? LED_ON : LED_OFF, __ATOMIC_RELEASE);
     
     // Submit the LED URB to handle the LED state change
     usb_submit_urb(kbd.led_urb);
@@ -208,13 +293,19 @@ void cleanup_resources() {
     if (kbd.int_ep_fd >= 0) close(kbd.int_ep_fd);
     if (kbd.ctrl_cmd_fd >= 0) close(kbd.ctrl_cmd_fd);
     if (kbd.ctrl_ack_fd >= 0) close(kbd.ctrl_ack_fd);
-    
-    pthread_mutex_destroy(&kbd.leds_lock);
 }
 
 // Close the USB device
 void usb_kbd_close() {
     should_terminate = 1;
+
+    // handlers in flight finish their endpoint I/O before the fds go away
+    if (kbd.int_urb) urb_worker_stop(&kbd.int_worker);
+    if (kbd.led_urb) urb_worker_stop(&kbd.led_worker);
+    if (driver_stats)
+        fprintf(stderr, "driver: %ld key and %ld LED completions, %ld URB threads created\n",
+            kbd.int_worker.completions, kbd.led_worker.completions, (long)urb_threads_created);
+
     cleanup_resources();
 }
 
@@ -238,57 +329,14 @@ int usb_kbd_open(void) {
     dev->led = LED_OFF;
     kbd.dev = dev;
     
-    // Initialize the mutex
-    pthread_mutex_init(&kbd.leds_lock, NULL);
-    
-    // Open the pipes
-    kbd.int_ep_fd = open("int_pipe", O_RDONLY | O_NONBLOCK);
-    kbd.ctrl_cmd_fd = open("ctrl_cmd_pipe", O_WRONLY);
-    kbd.ctrl_ack_fd = open("ctrl_ack_pipe", O_RDONLY);
-
-    if (kbd.int_ep_fd < 0 || kbd.ctrl_cmd_fd < 0 || kbd.ctrl_ack_fd < 0) {
-        perror("pipe open failed");
-        cleanup_resources();
-        return -1;
-    }
-    
-    // Make int_ep_fd blocking again now that it's open
-    int flags = fcntl(kbd.int_ep_fd, F_GETFL, 0);
-    fcntl(kbd.int_ep_fd, F_SETFL, flags & ~O_NONBLOCK);
-
-    // Set up shared memory for LED buffer
-    int shm_fd = shm_open(SHM_NAME, O_RDWR, 0666);
-    if (shm_fd == -1) {
-        perror("shm_open failed");
-        cleanup_resources();
-        return -1;
-    }
+    // Take the driver's ends of the inherited endpoints
+    kbd.int_ep_fd = int_pipe[0];
+    kbd.ctrl_cmd_fd = ctrl_cmd_pipe[1];
+    kbd.ctrl_ack_fd = ctrl_ack_pipe[0];
 
-    kbd.leds = mmap(0, LED_BUF_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    close(shm_fd);
-    
-    if (kbd.leds == MAP_FAILED) {
-        perror("mmap failed");
-        cleanup_resources();
-        return -1;
-    }
-    
-    // Set up shared memory for termination flag
-    int terminate_fd = shm_open(TERMINATE_SHM, O_RDWR, 0666);
-    if (terminate_fd == -1) {
-        perror("shm_open for terminate flag failed");
-        cleanup_resources();
-        return -1;
-    }
-    
-    kbd.terminate_flag = mmap(0, 1, PROT_READ | PROT_WRITE, MAP_SHARED, terminate_fd, 0);
-    close(terminate_fd);
-    
-    if (kbd.terminate_flag == MAP_FAILED) {
-        perror("mmap for terminate flag failed");
-        cleanup_resources();
-        return -1;
-    }
+    // and the shared LED buffer and termination flag
+    kbd.leds = shared_leds;
+    kbd.terminate_flag = shared_terminate_flag;
     
     // Create URBs
     kbd.int_urb = malloc(sizeof(urb));
@@ -308,10 +356,29 @@ int usb_kbd_open(void) {
     kbd.led_urb->endpoint_type = 1; // Control endpoint
     kbd.led_urb->active = 0;
     kbd.led_urb->context = &kbd;
+
+    kbd.int_urb->worker = &kbd.int_worker;
+    kbd.led_urb->worker = &kbd.led_worker;
+    if (urb_worker_start(&kbd.int_worker, usb_kbd_irq) < 0) {
+        cleanup_resources();
+        return -1;
+    }
+    if (urb_worker_start(&kbd.led_worker, usb_kbd_led) < 0) {
+        urb_worker_stop(&kbd.int_worker);
+        cleanup_resources();
+        return -1;
+    }
     
-    // Submit the URBs to start the threads
+    // Submit the URBs to start the endpoints
     usb_submit_urb(kbd.int_urb);
     usb_submit_urb(kbd.led_urb);
+
+    if (driver_stats) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        fprintf(stderr, "driver: ready %.1f us after start\n",
+            (now.tv_sec - start_time.tv_sec) * 1e6 + (now.tv_nsec - start_time.tv_nsec) / 1e3);
+    }
     
     return 0;
 }
@@ -348,20 +415,15 @@ void* control_listener(void* arg) {
     unsigned char* leds = (unsigned char*)arg;
     int prev_state = LED_OFF;
 
-    int ctrl_cmd_fd = open("ctrl_cmd_pipe", O_RDONLY);
-    int ctrl_ack_fd = open("ctrl_ack_pipe", O_WRONLY);
-
-    if (ctrl_cmd_fd < 0 || ctrl_ack_fd < 0) {
-        perror("keyboard: control pipe open failed");
-        exit(1);
-    }
+    int ctrl_cmd_fd = ctrl_cmd_pipe[0];
+    int ctrl_ack_fd = ctrl_ack_pipe[1];
 
     while (1) {
         char cmd;
         if(read(ctrl_cmd_fd, &cmd, 1) < 0) break;
 
         if (cmd == 'C') {
-            int curr = *leds;
+            int curr = __atomic_load_n(leds, __ATOMIC_ACQUIRE);
             if (curr != prev_state) {
                 if (curr == LED_ON) printf("ON ");
                 else printf("OFF ");
@@ -382,31 +444,29 @@ void* control_listener(void* arg) {
 }
 
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s <input_file>\n", argv[0]);
+    int opt;
+    while ((opt = getopt(argc, argv, "v")) != -1) {
+        if (opt == 'v') driver_stats = 1;
+        else {
+            fprintf(stderr, "Usage: %s [-v] <input_file>\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-v] <input_file>\n", argv[0]);
         exit(1);
     }
 
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
     // Create pipes (simulate endpoints)
-    unlink("int_pipe");
-    unlink("ctrl_cmd_pipe");
-    unlink("ctrl_ack_pipe");
-    
-    mkfifo("int_pipe", 0666);
-    mkfifo("ctrl_cmd_pipe", 0666);
-    mkfifo("ctrl_ack_pipe", 0666);
-    
-    // Create shared memory for termination flag
-    int term_shm_fd = shm_open(TERMINATE_SHM, O_CREAT | O_RDWR, 0666);
-    if (term_shm_fd == -1) {
-        perror("Failed to create terminate shared memory");
+    if (pipe(int_pipe) < 0 || pipe(ctrl_cmd_pipe) < 0 || pipe(ctrl_ack_pipe) < 0) {
+        perror("Failed to create endpoint pipes");
         exit(1);
     }
     
-    ftruncate(term_shm_fd, 1);
-    unsigned char* terminate_flag = mmap(0, 1, PROT_READ | PROT_WRITE, MAP_SHARED, term_shm_fd, 0);
-    close(term_shm_fd);
-    
+    // Shared memory for the termination flag and the LED buffer
+    unsigned char* terminate_flag = mmap(0, 1, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
     if (terminate_flag == MAP_FAILED) {
         perror("Failed to map terminate shared memory");
         exit(1);
@@ -414,28 +474,16 @@ int main(int argc, char* argv[]) {
     
     *terminate_flag = 0; // Initially not terminated
     
-    // Create shared memory for LED buffer
-    int shm_fd = shm_open(SHM_NAME, O_CREAT | O_RDWR, 0666);
-    if (shm_fd == -1) {
-        perror("Failed to create LED shared memory");
-        munmap(terminate_flag, 1);
-        shm_unlink(TERMINATE_SHM);
-        exit(1);
-    }
-    
-    ftruncate(shm_fd, LED_BUF_SIZE);
-    unsigned char* leds = mmap(0, LED_BUF_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    close(shm_fd);
-    
+    unsigned char* leds = mmap(0, LED_BUF_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
     if (leds == MAP_FAILED) {
         perror("keyboard: mmap failed");
         munmap(terminate_flag, 1);
-        shm_unlink(TERMINATE_SHM);
-        shm_unlink(SHM_NAME);
         exit(1);
     }
 
     *leds = LED_OFF; // Initially OFF
+    shared_leds = leds;
+    shared_terminate_flag = terminate_flag;
     
     // Fork to create driver and keyboard processes
     pid_t pid = fork();
@@ -443,36 +491,31 @@ int main(int argc, char* argv[]) {
         perror("Fork failed");
         munmap(leds, LED_BUF_SIZE);
         munmap(terminate_flag, 1);
-        shm_unlink(SHM_NAME);
-        shm_unlink(TERMINATE_SHM);
         exit(1);
     }
     
     if (pid == 0) {
-        // Child process - run driver
-        munmap(leds, LED_BUF_SIZE);
-        munmap(terminate_flag, 1);
+        // Child process - run driver, on the driver's ends of the endpoints
+        close(int_pipe[1]);
+        close(ctrl_cmd_pipe[0]);
+        close(ctrl_ack_pipe[1]);
         return driver();
     }
     
-    // Parent process - simulate keyboard
-    int int_pipe_fd = open("int_pipe", O_WRONLY);
-    if (int_pipe_fd < 0) {
-        perror("keyboard: can't open int_pipe");
-        kill(pid, SIGTERM);
-        munmap(leds, LED_BUF_SIZE);
-        munmap(terminate_flag, 1);
-        shm_unlink(SHM_NAME);
-        shm_unlink(TERMINATE_SHM);
-        exit(1);
-    }
+    // Parent process - simulate keyboard. The listener may still ack after
+    // the driver has gone; that should fail the write, not kill the process
+    signal(SIGPIPE, SIG_IGN);
+    close(int_pipe[0]);
+    close(ctrl_cmd_pipe[1]);
+    close(ctrl_ack_pipe[0]);
+    int int_pipe_fd = int_pipe[1];
 
     // Start LED control listener thread
     pthread_t ctrl_thread;
     pthread_create(&ctrl_thread, NULL, control_listener, leds);
 
     // Read input file
-    FILE* file = fopen(argv[1], "r");
+    FILE* file = fopen(argv[optind], "r");
     if (!file) {
         perror("keyboard: can't open input file");
         close(int_pipe_fd);
@@ -482,8 +525,6 @@ int main(int argc, char* argv[]) {
         kill(pid, SIGTERM);
         munmap(leds, LED_BUF_SIZE);
         munmap(terminate_flag, 1);
-        shm_unlink(SHM_NAME);
-        shm_unlink(TERMINATE_SHM);
         exit(1);
     }
 
@@ -513,12 +554,6 @@ int main(int argc, char* argv[]) {
     // Clean up resources
     munmap(leds, LED_BUF_SIZE);
     munmap(terminate_flag, 1);
-    shm_unlink(SHM_NAME);
-    shm_unlink(TERMINATE_SHM);
-    
-    unlink("int_pipe");
-    unlink("ctrl_cmd_pipe");
-    unlink("ctrl_ack_pipe");
     
     printf("\n");
     return 0;
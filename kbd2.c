@@ -20,6 +20,10 @@
 #define URB_TYPE_INT  1
 #define URB_TYPE_CTRL 2
 
+// The interrupt and control endpoints run on different threads, so state
+// either of them writes per transfer gets a cache line of its own
+#define CACHE_LINE 64
+
 // Forward declarations
 struct usb_kbd;
 struct input_dev;
@@ -30,17 +34,20 @@ typedef void (*urb_complete_t)(struct urb *);
 
 // URB structure for USB requests
 struct urb {
+    // set up at open, read-mostly afterwards
     int type;                 // URB_TYPE_INT or URB_TYPE_CTRL
+    int pipe;                 // Pipe to use for this URB
     void *transfer_buffer;    // Buffer for data transfer
     int transfer_buffer_length; // Length of the buffer
     urb_complete_t complete;  // Completion handler
     void *context;            // Context for the completion handler
-    int pipe;                 // Pipe to use for this URB
-    int status;               // Status of the URB
-    int actual_length;        // Actual length of data transferred
     pthread_t thread;         // Thread handling this URB
+
+    // written on every transfer
+    int status __attribute__((aligned(CACHE_LINE))); // Status of the URB
+    int actual_length;        // Actual length of data transferred
     int active;               // Whether this URB is active
-};
+} __attribute__((aligned(CACHE_LINE)));
 
 // Input device structure
 struct input_dev {
@@ -50,21 +57,20 @@ struct input_dev {
 
 // USB keyboard device structure
 struct usb_kbd {
+    // read-mostly: every endpoint thread reads these, nothing writes them
+    // while the keyboard is open
     struct input_dev* dev;            // Input device
     
     int int_ep_fd;                    // Interrupt endpoint file descriptor
     int ctrl_cmd_fd;                  // Control command file descriptor
     int ctrl_ack_fd;                  // Control acknowledgment file descriptor
+    int open;                         // Whether the keyboard is open
     
-    unsigned char* leds;              // LED buffer
-    
-    pthread_mutex_t leds_lock;        // Lock for LED buffer
+    unsigned char* leds;              // LED byte, written with a release store
     
     struct urb *irq_urb;              // URB for interrupt endpoint
     struct urb *led_urb;              // URB for LED control
-    
-    int open;                         // Whether the keyboard is open
-};
+} __attribute__((aligned(CACHE_LINE)));
 
 typedef struct usb_kbd usb_kbd;
 typedef struct input_dev input_dev;
@@ -76,9 +82,16 @@ int usb_submit_urb(struct urb *urb);
 void usb_kbd_irq(struct urb *urb);
 void usb_kbd_led(struct urb *urb);
 int usb_kbd_open(struct usb_kbd *kbd);
+void *urb_int_thread(struct urb *urb);
+void *urb_ctrl_thread(struct urb *urb);
 
-// Shared memory name
-#define SHM_NAME "/led_shm"
+// Endpoint pipes and the LED buffer are set up before the fork and
+// inherited by the driver, so nothing is left behind in the filesystem.
+// Pipe ends: [0] read, [1] write.
+int int_pipe[2];
+int ctrl_cmd_pipe[2];
+int ctrl_ack_pipe[2];
+unsigned char *shared_leds;
 
 // Global variables
 usb_kbd kbd;
@@ -97,12 +110,11 @@ void print_char(char ch) {
 
 // Input device event callback
 void usb_kbd_event(struct input_dev* dev_ptr) {
-    struct usb_kbd *kbd = container_of(dev_ptr, struct usb_kbd, dev);
+    // dev is a pointer member, so container_of can't recover the keyboard;
+    // there is only the one
     
-    // Update LED state
-    pthread_mutex_lock(&kbd->leds_lock);
-    *(kbd->leds) = dev_ptr->led;
-    pthread_mutex_unlock(&kbd->leds_lock);
+    // Update LED state: one byte, so a release store publishes it whole
+    __atomic_store_n(kbd.leds, dev_ptr->led, __ATOMIC_RELEASE);
     
     // Send control command
     write(kbd.ctrl_cmd_fd, "C", 1);
@@ -121,8 +133,8 @@ void usb_kbd_event(struct input_dev* dev_ptr) {
     }
     
     // Submit a new LED URB to maintain the control endpoint
-    if (kbd->led_urb) {
-        usb_submit_urb(kbd->led_urb);
+    if (kbd.led_urb) {
+        usb_submit_urb(kbd.led_urb);
     }
 }
 
@@ -257,35 +269,15 @@ int usb_kbd_open(struct usb_kbd *kbd) {
     dev->led = LED_OFF;
     kbd->dev = dev;
     
-    // Initialize locks
-    pthread_mutex_init(&kbd->leds_lock, NULL);
-    
-    // Open pipes
-    kbd->int_ep_fd = open("int_pipe", O_RDONLY);
-    kbd->ctrl_cmd_fd = open("ctrl_cmd_pipe", O_WRONLY);
-    kbd->ctrl_ack_fd = open("ctrl_ack_pipe", O_RDONLY);
-    
-    if (kbd->int_ep_fd < 0 || kbd->ctrl_cmd_fd < 0 || kbd->ctrl_ack_fd < 0) {
-        perror("pipe open failed");
-        return -1;
-    }
-    
-    // Set up shared memory for LED buffer
-    int shm_fd = shm_open(SHM_NAME, O_RDWR, 0666);
-    if (shm_fd == -1) {
-        perror("shm_open failed");
-        return -1;
-    }
-    
-    kbd->leds = mmap(0, LED_BUF_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    if (kbd->leds == MAP_FAILED) {
-        perror("mmap failed");
-        return -1;
-    }
+    // Driver ends of the inherited pipes, and the LED buffer
+    kbd->int_ep_fd = int_pipe[0];
+    kbd->ctrl_cmd_fd = ctrl_cmd_pipe[1];
+    kbd->ctrl_ack_fd = ctrl_ack_pipe[0];
+    kbd->leds = shared_leds;
     
     // Create URBs
-    // Interrupt URB
-    kbd->irq_urb = malloc(sizeof(struct urb));
+    // Interrupt URB, line-aligned so the two URBs never share a line
+    kbd->irq_urb = aligned_alloc(CACHE_LINE, sizeof(struct urb));
     if (!kbd->irq_urb) return -1;
     
     kbd->irq_urb->type = URB_TYPE_INT;
@@ -297,7 +289,7 @@ int usb_kbd_open(struct usb_kbd *kbd) {
     kbd->irq_urb->thread = 0;
     
     // LED URB
-    kbd->led_urb = malloc(sizeof(struct urb));
+    kbd->led_urb = aligned_alloc(CACHE_LINE, sizeof(struct urb));
     if (!kbd->led_urb) return -1;
     
     kbd->led_urb->type = URB_TYPE_CTRL;
@@ -337,24 +329,21 @@ int driver() {
     return 0;
 }
 
+int capslock_led_state = 0; // 0: OFF, 1: ON
+
 // Control listener for keyboard process
 void* control_listener(void* arg) {
     unsigned char* leds = (unsigned char*)arg;
 
-    int ctrl_cmd_fd = open("ctrl_cmd_pipe", O_RDONLY);
-    int ctrl_ack_fd = open("ctrl_ack_pipe", O_WRONLY);
-
-    if (ctrl_cmd_fd < 0 || ctrl_ack_fd < 0) {
-        perror("keyboard: control pipe open failed");
-        exit(1);
-    }
+    int ctrl_cmd_fd = ctrl_cmd_pipe[0];
+    int ctrl_ack_fd = ctrl_ack_pipe[1];
 
     while (1) {
         char cmd;
         if (read(ctrl_cmd_fd, &cmd, 1) <= 0) break;
 
         if (cmd == 'C') {
-            if (*leds == LED_ON) {
+            if (__atomic_load_n(leds, __ATOMIC_ACQUIRE) == LED_ON) {
                 capslock_led_state = 1;  // Turn on
             } else {
                 capslock_led_state = 0;  // Turn off
@@ -374,34 +363,37 @@ int main(int argc, char* argv[]) {
         exit(1);
     }
 
-    // Fork to create driver process
-    pid_t pid = fork();
-    if (pid < 0) return -1;
-    if (pid == 0) return driver();
-
-    // Keyboard process continues here
-    
     // Create pipes (simulate endpoints)
-    mkfifo("int_pipe", 0666);
-    mkfifo("ctrl_cmd_pipe", 0666);
-    mkfifo("ctrl_ack_pipe", 0666);
-
-    int int_pipe_fd = open("int_pipe", O_WRONLY);
-    if (int_pipe_fd < 0) {
-        perror("keyboard: can't open int_pipe");
+    if (pipe(int_pipe) < 0 || pipe(ctrl_cmd_pipe) < 0 || pipe(ctrl_ack_pipe) < 0) {
+        perror("keyboard: pipe failed");
         exit(1);
     }
 
     // Create shared memory for LED buffer
-    int shm_fd = shm_open(SHM_NAME, O_CREAT | O_RDWR, 0666);
-    ftruncate(shm_fd, LED_BUF_SIZE);
-    unsigned char* leds = mmap(0, LED_BUF_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    unsigned char* leds = mmap(0, LED_BUF_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
     if (leds == MAP_FAILED) {
         perror("keyboard: mmap failed");
         exit(1);
     }
 
     *leds = LED_OFF; // Initially OFF
+    shared_leds = leds;
+
+    // Fork to create driver process
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        close(int_pipe[1]);
+        close(ctrl_cmd_pipe[0]);
+        close(ctrl_ack_pipe[1]);
+        return driver();
+    }
+
+    // Keyboard process continues here, on its own ends
+    close(int_pipe[0]);
+    close(ctrl_cmd_pipe[1]);
+    close(ctrl_ack_pipe[0]);
+    int int_pipe_fd = int_pipe[1];
 
     // Start LED control listener thread
     pthread_t ctrl_thread;
@@ -425,11 +417,6 @@ int main(int argc, char* argv[]) {
     pthread_join(ctrl_thread, NULL);
 
     munmap(leds, LED_BUF_SIZE);
-    shm_unlink(SHM_NAME);
-
-    unlink("int_pipe");
-    unlink("ctrl_cmd_pipe");
-    unlink("ctrl_ack_pipe");
 
     return 0;
 }
@@ -0,0 +1,158 @@
+#ifndef KEV_H
+#define KEV_H
+
+// KEV: compact binary capture of a keyboard session.
+//
+// A file is an 8-byte header ("KEV1" and 4 reserved bytes) followed by
+// records of
+//
+//     varint  (delta_us << 1) | release    LEB128, time since the previous record
+//     u8      usage                        HID keyboard usage, 0 for an idle report
+//     u8      mods                         HID modifier byte (KEV_MOD_*)
+//
+// so a typical key is three bytes. Files are read through mmap and decoded
+// in place. The helpers below also map between records and the one-byte
+// codes the interrupt endpoint carries ('#', '@', '&' and plain characters).
+
+#include <stdint.h>
+#include <string.h>
+
+#define KEV_MAGIC       "KEV1"
+#define KEV_HEADER_SIZE 8
+#define KEV_MAX_RECORD  12
+
+#define KEV_MOD_LCTRL  0x01
+#define KEV_MOD_LSHIFT 0x02
+#define KEV_MOD_LALT   0x04
+#define KEV_MOD_LGUI   0x08
+
+#define KEV_USAGE_IDLE     0x00
+#define KEV_USAGE_A        0x04
+#define KEV_USAGE_1        0x1e
+#define KEV_USAGE_0        0x27
+#define KEV_USAGE_ENTER    0x28
+#define KEV_USAGE_CAPSLOCK 0x39
+
+// wire codes, as in keyboard.c
+#define KEV_NO_EVENT         '#'
+#define KEV_CAPSLOCK_PRESS   '@'
+#define KEV_CAPSLOCK_RELEASE '&'
+
+struct kev_event {
+    uint64_t delta_us;
+    uint8_t usage;
+    uint8_t mods;
+    uint8_t release;
+};
+
+// usages 0x28..0x38, unshifted and shifted
+static const char kev_punct[2][17] = {
+    { '\n', 27, '\b', '\t', ' ', '-', '=', '[', ']', '\\', 0, ';', '\'', '`', ',', '.', '/' },
+    { 0, 0, 0, 0, 0, '_', '+', '{', '}', '|', 0, ':', '"', '~', '<', '>', '?' },
+};
+static const char kev_shift_digits[] = "!@#$%^&*()";
+
+static inline size_t kev_encode(unsigned char* out, const struct kev_event* ev) {
+    uint64_t v = (ev->delta_us << 1) | (ev->release & 1);
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    out[n++] = v;
+    out[n++] = ev->usage;
+    out[n++] = ev->mods;
+    return n;
+}
+
+// returns the record length, 0 if it runs past end
+static inline size_t kev_decode(const unsigned char* p, const unsigned char* end, struct kev_event* ev) {
+    const unsigned char* start = p;
+    uint64_t v = 0;
+    int shift = 0;
+
+    while (p < end && shift < 64) {
+        v |= (uint64_t)(*p & 0x7f) << shift;
+        shift += 7;
+        if (!(*p++ & 0x80)) break;
+    }
+    if (end - p < 2 || (p[-1] & 0x80)) return 0;
+
+    ev->delta_us = v >> 1;
+    ev->release = v & 1;
+    ev->usage = p[0];
+    ev->mods = p[1];
+    return p + 2 - start;
+}
+
+static inline int kev_is_file(const void* data, size_t len) {
+    return len >= KEV_HEADER_SIZE && !memcmp(data, KEV_MAGIC, 4);
+}
+
+static inline void kev_header(unsigned char* out) {
+    memcpy(out, KEV_MAGIC, 4);
+    memset(out + 4, 0, 4);
+}
+
+// wire code to a key press, 0 if the character has no key
+static inline int kev_from_char(char ch, struct kev_event* ev) {
+    ev->usage = 0;
+    ev->mods = 0;
+    ev->release = 0;
+
+    if (ch == KEV_NO_EVENT) return 1;
+    if (ch == KEV_CAPSLOCK_PRESS || ch == KEV_CAPSLOCK_RELEASE) {
+        ev->usage = KEV_USAGE_CAPSLOCK;
+        ev->release = ch == KEV_CAPSLOCK_RELEASE;
+        return 1;
+    }
+    if (ch >= 'a' && ch <= 'z') ev->usage = KEV_USAGE_A + ch - 'a';
+    else if (ch >= 'A' && ch <= 'Z') {
+        ev->usage = KEV_USAGE_A + ch - 'A';
+        ev->mods = KEV_MOD_LSHIFT;
+    }
+    else if (ch >= '1' && ch <= '9') ev->usage = KEV_USAGE_1 + ch - '1';
+    else if (ch == '0') ev->usage = KEV_USAGE_0;
+    else {
+        for (int shifted = 0; shifted < 2 && !ev->usage; shifted++) {
+            for (int i = 0; i < 17; i++) {
+                if (kev_punct[shifted][i] && kev_punct[shifted][i] == ch) {
+                    ev->usage = KEV_USAGE_ENTER + i;
+                    ev->mods = shifted ? KEV_MOD_LSHIFT : 0;
+                    break;
+                }
+            }
+        }
+        // shifted digits, except the ones the endpoint uses as control codes
+        const char* d = strchr(kev_shift_digits, ch);
+        if (!ev->usage && ch && d) {
+            ev->usage = d - kev_shift_digits == 9 ? KEV_USAGE_0 : KEV_USAGE_1 + (d - kev_shift_digits);
+            ev->mods = KEV_MOD_LSHIFT;
+        }
+    }
+    return ev->usage != 0;
+}
+
+// key event to the wire code the simulator sends, -1 if nothing is sent
+// (releases of ordinary keys, and keys the endpoint cannot carry)
+static inline int kev_to_char(const struct kev_event* ev) {
+    int shifted = (ev->mods & KEV_MOD_LSHIFT) != 0;
+    int u = ev->usage;
+    char ch = 0;
+
+    if (u == KEV_USAGE_IDLE) return KEV_NO_EVENT;
+    if (u == KEV_USAGE_CAPSLOCK) return ev->release ? KEV_CAPSLOCK_RELEASE : KEV_CAPSLOCK_PRESS;
+    if (ev->release) return -1;
+
+    if (u >= KEV_USAGE_A && u < KEV_USAGE_A + 26) ch = (shifted ? 'A' : 'a') + u - KEV_USAGE_A;
+    else if (u >= KEV_USAGE_1 && u <= KEV_USAGE_0) {
+        int i = u - KEV_USAGE_1;
+        ch = shifted ? kev_shift_digits[i] : (i == 9 ? '0' : '1' + i);
+    }
+    else if (u >= KEV_USAGE_ENTER && u < KEV_USAGE_ENTER + 17) ch = kev_punct[shifted][u - KEV_USAGE_ENTER];
+
+    if (!ch || ch == KEV_NO_EVENT || ch == KEV_CAPSLOCK_PRESS || ch == KEV_CAPSLOCK_RELEASE) return -1;
+    return (unsigned char)ch;
+}
+
+#endif
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "kev.h"
+
+// Converts today's ASCII simulator inputs to KEV captures, and dumps KEV
+// files in readable form.
+//
+// The ASCII format has no timing, so every character gets the simulator's
+// fixed polling interval: a press record, plus an immediate release for
+// ordinary keys. '#' becomes an idle report, '@'/'&' capslock press/release.
+
+void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-i interval_us] <input.txt> <output.kev>\n", prog);
+    fprintf(stderr, "       %s -d <file.kev>\n", prog);
+    exit(1);
+}
+
+int convert(const char* in, const char* out, long interval) {
+    FILE* src = fopen(in, "r");
+    if (!src) {
+        perror("unable to open input file");
+        return 1;
+    }
+    FILE* dst = fopen(out, "w");
+    if (!dst) {
+        perror("unable to open output file");
+        return 1;
+    }
+
+    unsigned char rec[2 * KEV_MAX_RECORD];
+    kev_header(rec);
+    fwrite(rec, 1, KEV_HEADER_SIZE, dst);
+
+    long keys = 0, skipped = 0, bytes = KEV_HEADER_SIZE;
+    int ch;
+    while ((ch = fgetc(src)) != EOF) {
+        struct kev_event ev;
+        if (!kev_from_char(ch, &ev)) {
+            skipped++;
+            continue;
+        }
+        ev.delta_us = keys++ ? interval : 0;
+        size_t n = kev_encode(rec, &ev);
+
+        if (ev.usage != KEV_USAGE_IDLE && ev.usage != KEV_USAGE_CAPSLOCK) {
+            ev.delta_us = 0;
+            ev.release = 1;
+            n += kev_encode(rec + n, &ev);
+        }
+        fwrite(rec, 1, n, dst);
+        bytes += n;
+    }
+
+    fclose(src);
+    fclose(dst);
+    fprintf(stderr, "%ld keys, %ld bytes", keys, bytes);
+    if (skipped) fprintf(stderr, ", %ld characters without a key skipped", skipped);
+    fprintf(stderr, "\n");
+    return 0;
+}
+
+int dump(const char* path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror("unable to open capture");
+        return 1;
+    }
+
+    unsigned char* data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED || !kev_is_file(data, st.st_size)) {
+        fprintf(stderr, "%s: not a KEV capture\n", path);
+        return 1;
+    }
+
+    const unsigned char* p = data + KEV_HEADER_SIZE;
+    const unsigned char* end = data + st.st_size;
+    unsigned long long t = 0;
+    struct kev_event ev;
+    size_t n;
+
+    while ((n = kev_decode(p, end, &ev))) {
+        p += n;
+        t += ev.delta_us;
+        int ch = kev_to_char(&ev);
+        printf("%12llu %-7s usage 0x%02x mods 0x%02x", t, ev.release ? "release" : "press", ev.usage, ev.mods);
+        if (ch >= 0) printf("  '%c'", ch == '\n' ? ' ' : ch);
+        printf("\n");
+    }
+    if (p != end) fprintf(stderr, "%s: truncated record at offset %ld\n", path, (long)(p - data));
+
+    munmap(data, st.st_size);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    long interval = 20000; // the simulator's usleep(20000)
+    int dump_mode = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:d")) != -1) {
+        switch (opt) {
+        case 'i': interval = atol(optarg); break;
+        case 'd': dump_mode = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+
+    if (dump_mode) {
+        if (optind + 1 != argc) usage(argv[0]);
+        return dump(argv[optind]);
+    }
+    if (optind + 2 != argc) usage(argv[0]);
+    return convert(argv[optind], argv[optind + 1], interval);
+}
@@ -0,0 +1,123 @@
+#ifndef KEYBITS_H
+#define KEYBITS_H
+
+// Pressed-key state: one bit per HID usage, 256 bits per device.
+//
+// Reports are applied as bitmaps too. What changed is the XOR of the old
+// and new state, and the events are walked off it with count-trailing-zeros,
+// one word at a time, so a report costs a few word operations plus one step
+// per key that actually moved. Queries (is a modifier held, how many keys
+// are down, is any of a set held) are fixed four-word vector operations,
+// independent of how many keys are down; GCC turns the vector type into
+// SSE2/AVX2 as the target allows.
+//
+// The interrupt endpoint carries keystrokes rather than full HID reports,
+// so keybits_report takes the keys one report names and:
+//   - releases keys that have no release code of their own (everything but
+//     the sticky ones, i.e. capslock) as the next report arrives
+//   - releases and re-presses a key the report names again, since on the
+//     wire that is a second keystroke
+// A sticky key only comes up with keybits_release.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "kev.h"
+
+#define KEYBITS_WORDS 4
+
+#define KEYBITS_USAGE_LCTRL 0xe0   // modifiers are usages 0xe0..0xe7
+#define KEYBITS_USAGE_LSHIFT 0xe1
+
+// aligned(8) so a struct keybits can sit in malloc'd memory
+typedef uint64_t keybits_vec __attribute__((vector_size(32), aligned(8)));
+
+struct keybits {
+    keybits_vec down;
+    keybits_vec sticky;     // keys that stay down until released explicitly
+};
+
+// press or release of one usage
+typedef void (*keybits_cb)(int usage, int pressed, void* arg);
+
+static inline void keybits_init(struct keybits* k) {
+    memset(k, 0, sizeof(*k));
+    k->sticky[KEV_USAGE_CAPSLOCK / 64] |= 1ull << (KEV_USAGE_CAPSLOCK % 64);
+}
+
+static inline void keybits_set(keybits_vec* v, int usage) {
+    (*v)[usage / 64] |= 1ull << (usage % 64);
+}
+
+static inline int keybits_test(const struct keybits* k, int usage) {
+    return k->down[usage / 64] >> (usage % 64) & 1;
+}
+
+static inline int keybits_any(const keybits_vec* v) {
+    return ((*v)[0] | (*v)[1] | (*v)[2] | (*v)[3]) != 0;
+}
+
+// is any key of set held
+static inline int keybits_held_any(const struct keybits* k, const keybits_vec* set) {
+    keybits_vec held = k->down & *set;
+    return keybits_any(&held);
+}
+
+static inline int keybits_count(const struct keybits* k) {
+    return __builtin_popcountll(k->down[0]) + __builtin_popcountll(k->down[1])
+        + __builtin_popcountll(k->down[2]) + __builtin_popcountll(k->down[3]);
+}
+
+// modifier byte, in HID order (KEV_MOD_*)
+static inline int keybits_mods(const struct keybits* k) {
+    return k->down[KEYBITS_USAGE_LCTRL / 64] >> (KEYBITS_USAGE_LCTRL % 64) & 0xff;
+}
+
+// emits one event per bit of changed, lowest usage first
+static inline void keybits_emit(const keybits_vec* changed, int pressed, keybits_cb cb, void* arg) {
+    for (int w = 0; w < KEYBITS_WORDS; w++)
+        for (uint64_t b = (*changed)[w]; b; b &= b - 1) cb(w * 64 + __builtin_ctzll(b), pressed, arg);
+}
+
+// state becomes next. The state is updated before any event goes out, so
+// a callback sees the whole report: a shift that goes down with a key is
+// held when the key is seen.
+static inline void keybits_update(struct keybits* k, const keybits_vec* next, keybits_cb cb, void* arg) {
+    keybits_vec diff = k->down ^ *next;
+    k->down = *next;
+    if (!keybits_any(&diff)) return;
+    keybits_vec up = diff & ~k->down, down = diff & k->down;
+    keybits_emit(&up, 0, cb, arg);
+    keybits_emit(&down, 1, cb, arg);
+}
+
+static inline void keybits_report(struct keybits* k, const keybits_vec* report, keybits_cb cb, void* arg) {
+    // up first: keys without a release code, and keys typed again
+    keybits_vec next = k->down & k->sticky & ~*report;
+    keybits_update(k, &next, cb, arg);
+    next = k->down | *report;
+    keybits_update(k, &next, cb, arg);
+}
+
+static inline void keybits_release(struct keybits* k, int usage, keybits_cb cb, void* arg) {
+    keybits_vec next = k->down;
+    next[usage / 64] &= ~(1ull << (usage % 64));
+    keybits_update(k, &next, cb, arg);
+}
+
+// applies one wire code as a report: the key it names, with shift if it
+// needs it, or a release for '&'. Returns 0 if it names no key.
+static inline int keybits_char(struct keybits* k, char ch, keybits_cb cb, void* arg) {
+    struct kev_event ev;
+    keybits_vec report = { 0, 0, 0, 0 };
+    int named = kev_from_char(ch, &ev) && ev.usage;
+    if (named && !ev.release) {
+        keybits_set(&report, ev.usage);
+        if (ev.mods & KEV_MOD_LSHIFT) keybits_set(&report, KEYBITS_USAGE_LSHIFT);
+    }
+    keybits_report(k, &report, cb, arg);
+    if (named && ev.release) keybits_release(k, ev.usage, cb, arg);
+    return named;
+}
+
+#endif
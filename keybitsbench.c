@@ -0,0 +1,160 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+#include "keybits.h"
+
+// Pressed-key bitmap benchmark (keybits.h).
+//
+// First a check: keys whose usages sit in all four 64-bit words, 128 and
+// up included, go down and come up through reports, a re-press and an
+// explicit release, and after every step the events seen, count, test and
+// held_any are compared with a plain array of 256 flags kept alongside.
+// Then -k M random reports of 1-6 keys each go through keybits_report,
+// and the queries are timed on their own.
+
+#define CHECK_KEYS 12
+
+double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+uint32_t rng = 1;
+
+uint32_t next_rand() {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+// the model: one flag per usage, and the events keybits should send
+struct model {
+    uint8_t down[256];
+    int presses, releases;
+    int failed;
+};
+
+void on_event(int usage, int pressed, void* arg) {
+    struct model* m = arg;
+    if (m->down[usage] == pressed) {
+        printf("  usage 0x%02x %s twice\n", usage, pressed ? "pressed" : "released");
+        m->failed = 1;
+    }
+    m->down[usage] = pressed;
+    if (pressed) m->presses++;
+    else m->releases++;
+}
+
+void compare(const char* step, const struct keybits* k, struct model* m, const keybits_vec* set) {
+    int count = 0, held = 0;
+    for (int u = 0; u < 256; u++) {
+        count += m->down[u];
+        held |= m->down[u] && (*set)[u / 64] >> (u % 64) & 1;
+        if (keybits_test(k, u) != m->down[u]) {
+            printf("  %s: test(0x%02x) is %d\n", step, u, keybits_test(k, u));
+            m->failed = 1;
+        }
+    }
+    if (keybits_count(k) != count || keybits_held_any(k, set) != held) {
+        printf("  %s: count %d held_any %d, want %d and %d\n", step, keybits_count(k),
+            keybits_held_any(k, set), count, held);
+        m->failed = 1;
+    }
+}
+
+int check() {
+    // two usages in each word, the sticky capslock and the modifiers among them
+    static const int usages[CHECK_KEYS] = { 0x04, 0x3f, 0x39, 0x40, 0x65, 0x7f, 0x80, 0x9a, 0xbf, 0xc0, 0xe1, 0xff };
+    struct keybits k;
+    struct model m;
+    memset(&m, 0, sizeof(m));
+    keybits_init(&k);
+    k.sticky[0xff / 64] |= 1ull << (0xff % 64);
+
+    // the held_any set: one key from the top word only
+    keybits_vec set = { 0, 0, 0, 0 };
+    keybits_set(&set, 0xc0);
+
+    // all down in one report; the non-sticky ones come up with the next
+    keybits_vec report = { 0, 0, 0, 0 };
+    for (int i = 0; i < CHECK_KEYS; i++) keybits_set(&report, usages[i]);
+    keybits_report(&k, &report, on_event, &m);
+    compare("all down", &k, &m, &set);
+
+    // one key named again: everything but the sticky keys comes up, it
+    // comes up and goes down again
+    keybits_vec again = { 0, 0, 0, 0 };
+    keybits_set(&again, 0xc0);
+    keybits_report(&k, &again, on_event, &m);
+    compare("0xc0 again", &k, &m, &set);
+
+    keybits_vec empty = { 0, 0, 0, 0 };
+    keybits_report(&k, &empty, on_event, &m);
+    compare("empty report", &k, &m, &set);
+
+    // the sticky keys stay down until released
+    keybits_release(&k, KEV_USAGE_CAPSLOCK, on_event, &m);
+    compare("capslock up", &k, &m, &set);
+    keybits_release(&k, 0xff, on_event, &m);
+    compare("0xff up", &k, &m, &set);
+
+    int ok = !m.failed && m.presses == CHECK_KEYS + 1 && m.releases == CHECK_KEYS + 1 && !keybits_count(&k);
+    printf("check: %d usages over 4 words, %d presses, %d releases: %s\n", CHECK_KEYS, m.presses, m.releases,
+        ok ? "ok" : "WRONG STATE");
+    return ok;
+}
+
+void count_events(int usage, int pressed, void* arg) {
+    ++*(unsigned long*)arg;
+}
+
+int main(int argc, char* argv[]) {
+    size_t reports = 16 << 20;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "k:")) != -1) {
+        switch (opt) {
+        case 'k': reports = (size_t)atol(optarg) << 20; break;
+        default:
+            fprintf(stderr, "Usage: %s [-k mreports]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    int ok = check();
+
+    keybits_vec* stream = malloc(reports * sizeof(keybits_vec));
+    for (size_t i = 0; i < reports; i++) {
+        keybits_vec r = { 0, 0, 0, 0 };
+        for (int n = 1 + next_rand() % 6; n; n--) keybits_set(&r, next_rand() % 256);
+        stream[i] = r;
+    }
+
+    struct keybits k;
+    unsigned long events = 0, sum = 0;
+    keybits_init(&k);
+    double start = now_sec();
+    for (size_t i = 0; i < reports; i++) keybits_report(&k, &stream[i], count_events, &events);
+    double secs = now_sec() - start;
+    printf("%zu M reports in %.3fs = %.1f ns/report, %lu events\n", reports >> 20, secs, secs * 1e9 / reports,
+        events);
+
+    // queries against the state each report leaves
+    keybits_init(&k);
+    start = now_sec();
+    for (size_t i = 0; i < reports; i++) {
+        k.down = stream[i];
+        sum += keybits_count(&k) + keybits_held_any(&k, &stream[i ^ 1]) + keybits_test(&k, i & 0xff);
+    }
+    secs = now_sec() - start;
+    printf("  count + held_any + test: %.1f ns/report (checksum %lu)\n", secs * 1e9 / reports, sum);
+
+    free(stream);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,6 +9,26 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+
+#include "lockstat.h"
+#include "ring.h"
+#include "kev.h"
+#include "affinity.h"
+#include "evq.h"
+#include "matrix.h"
+#include "keybits.h"
+#include "debounce.h"
+#include "hotkey.h"
+#include "outq.h"
+#include "macro.h"
+#include "ldisc.h"
 
 #define LED_BUF_SIZE 1
 
@@ -18,13 +39,21 @@
 #define LED_ON 1
 #define LED_OFF 0
 
-#define SHM_NAME "/led_shm"
+#define CACHE_LINE 64
+
+// wake-up latency histogram: exact below 32 ns, then 32 buckets per power
+// of two, so a percentile is within 3%
+#define INT_LAT_SUB     32
+#define INT_LAT_BUCKETS (59 * INT_LAT_SUB + INT_LAT_SUB)
 
 struct input_dev {
     void (*event)(struct input_dev* dev);
     int led;
+    struct keybits keys; // pressed keys, one bit per HID usage
+    struct debounce deb;
 };
 
+// read-mostly endpoint config, on a line of its own
 struct usb_kbd {
     struct input_dev* dev;
 
@@ -32,9 +61,8 @@ struct usb_kbd {
     int ctrl_cmd_fd; // control endpoint
     int ctrl_ack_fd; // ack
 
-    unsigned char* leds;
-    pthread_mutex_t leds_lock;
-};
+    unsigned char* leds; // one byte shared with the simulator, see usb_kbd_event
+} __attribute__((aligned(CACHE_LINE)));
 
 typedef struct usb_kbd usb_kbd;
 typedef struct input_dev input_dev;
@@ -44,11 +72,214 @@ void input_report_key(struct usb_kbd* kbd, unsigned int code, int value);
 usb_kbd kbd;
 int capslock_state = 0;
 
+// interrupt endpoint transport: the int_pipe pipe, or a shared-memory ring
+int use_ring = 0;
+struct kbd_ring* ring;
+
+// endpoints and shared regions are anonymous, created before fork and
+// inherited by the driver, so nothing is named and any number of instances
+// can run side by side. Pipes are [0] read end, [1] write end.
+int int_pipe[2];        // simulator -> driver
+int ctrl_cmd_pipe[2];   // driver -> control listener
+int ctrl_ack_pipe[2];   // control listener -> driver
+unsigned char* shared_leds;
+
+LOCKSTAT(int_ep_stat, "int_pipe", "simulator");
+LOCKSTAT(ctrl_ack_stat, "ctrl_ack_pipe", "control_listener");
+
+// adaptive polling of the interrupt endpoint: while keys keep arriving
+// within the spin budget the reader busy-polls, otherwise it blocks
+long spin_budget_ns = 0;
+struct {
+    unsigned long reads;
+    unsigned long spin_hits;
+    unsigned long blocks;
+    unsigned long long spin_ns;
+    unsigned long long gap_ewma;
+    unsigned long long last;
+    unsigned long stamped;
+    unsigned long wake[INT_LAT_BUCKETS];
+} int_poll __attribute__((aligned(CACHE_LINE))); // written per key
+
+// with -p the simulator stamps each report as it writes it, into a shared
+// slot picked by the report's sequence number; the reader takes the stamp
+// of every report it gets and counts read time minus stamp as wake-up
+// latency. Twice the endpoint's depth in slots, so a stamp is never
+// overwritten before its report has been read.
+#define INT_STAMPS (2 * RING_SIZE)
+unsigned long long* int_stamps;
+unsigned long int_sent;
+
+unsigned long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline unsigned int_lat_bucket(unsigned long long ns) {
+    if (ns < INT_LAT_SUB) return ns;
+    int msb = 63 - __builtin_clzll(ns);
+    return (msb - 4) * INT_LAT_SUB + (ns >> (msb - 5)) - INT_LAT_SUB;
+}
+
+// lower bound of a bucket, in ns
+static inline unsigned long long int_lat_value(unsigned b) {
+    if (b < INT_LAT_SUB) return b;
+    return (unsigned long long)(INT_LAT_SUB + b % INT_LAT_SUB) << (b / INT_LAT_SUB - 1);
+}
+
+// latency at quantile q of the counted reports
+unsigned long long int_lat_quantile(double q, unsigned long total) {
+    unsigned long want = (unsigned long)ceil(q * total), seen = 0;
+    for (unsigned b = 0; b < INT_LAT_BUCKETS; b++) {
+        seen += int_poll.wake[b];
+        if (seen >= want && seen) return int_lat_value(b);
+    }
+    return 0;
+}
+
+// non-blocking attempt, -1 when nothing is there yet
+ssize_t int_ep_try_read(char* ch) {
+    if (use_ring) {
+        if (ring_avail(ring) || ring_closed(ring)) return ring_read(ring, ch, 1);
+        return -1;
+    }
+    ssize_t n = read(kbd.int_ep_fd, ch, 1);
+    if (n < 0 && errno != EAGAIN) return 0;
+    return n;
+}
+
+ssize_t int_ep_read(char* ch) {
+    unsigned long long start = now_ns();
+    ssize_t n = -1;
+
+    int_poll.reads++;
+    if (spin_budget_ns && int_poll.gap_ewma < 2ull * spin_budget_ns) {
+        do {
+            n = int_ep_try_read(ch);
+            if (n >= 0) break;
+            __builtin_ia32_pause();
+        } while (now_ns() - start < (unsigned long long)spin_budget_ns);
+        int_poll.spin_ns += now_ns() - start;
+        if (n >= 0) int_poll.spin_hits++;
+    }
+
+    if (n < 0) {
+        int_poll.blocks++;
+        if (use_ring) n = ring_read(ring, ch, 1);
+        else {
+            if (spin_budget_ns) {
+                struct pollfd pfd = { kbd.int_ep_fd, POLLIN, 0 };
+                poll(&pfd, 1, -1);
+            }
+            n = lockstat_read(&int_ep_stat, kbd.int_ep_fd, ch, 1);
+        }
+    }
+
+    unsigned long long t = now_ns();
+    if (int_poll.last)
+        int_poll.gap_ewma = (int_poll.gap_ewma * 7 + (t - int_poll.last)) / 8;
+    int_poll.last = t;
+    if (int_stamps && n > 0) {
+        unsigned long long sent = int_stamps[int_poll.stamped++ % INT_STAMPS];
+        if (sent) int_poll.wake[int_lat_bucket(t > sent ? t - sent : 0)]++;
+    }
+    return n;
+}
+
+// optional event queue (-q) between the endpoint reader and dispatch,
+// which then runs on a thread of its own
+unsigned evq_size = 0;
+int evq_policy = EVQ_BLOCK;
+struct evq int_queue;
+
+// optional debounce (-d) between the key bitmap and the handlers
+int deb_mode = DEB_OFF;
+unsigned deb_window = DEB_WINDOW;
+
+// optional hotkey matching (-H) over the delivered keys
+const char* hk_path = NULL;
+struct hotkeys hotkeys;
+
+void hotkey_matched(int pattern, const char* name, void* arg) {
+    fprintf(stderr, "hotkey: %s\n", name);
+}
+
+// driver-side session recorder (-r), KEV format
+const char* rec_path = NULL;
+FILE* rec_file = NULL;
+unsigned long long rec_last = 0;
+
+void record_key(char ch) {
+    struct kev_event ev;
+    unsigned char buf[2 * KEV_MAX_RECORD];
+
+    if (!kev_from_char(ch, &ev)) return;
+    unsigned long long t = now_ns() / 1000;
+    ev.delta_us = rec_last ? t - rec_last : 0;
+    rec_last = t;
+
+    size_t n = kev_encode(buf, &ev);
+    if (ev.usage != KEV_USAGE_IDLE && ev.usage != KEV_USAGE_CAPSLOCK) {
+        ev.delta_us = 0;
+        ev.release = 1;
+        n += kev_encode(buf + n, &ev);
+    }
+    fwrite(buf, 1, n, rec_file);
+}
+
+void print_poll_stats() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    double cpu_ms = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3
+        + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3;
+
+    fprintf(stderr, "\nint poll: %lu reads, %lu caught spinning (%.1f%%), %lu blocked, "
+        "spun %.1f ms, driver cpu %.1f ms\n",
+        int_poll.reads, int_poll.spin_hits,
+        int_poll.reads ? 100.0 * int_poll.spin_hits / int_poll.reads : 0.0,
+        int_poll.blocks, int_poll.spin_ns / 1e6, cpu_ms);
+
+    unsigned long woken = 0;
+    for (unsigned b = 0; b < INT_LAT_BUCKETS; b++) woken += int_poll.wake[b];
+    if (woken)
+        fprintf(stderr, "int poll: wake-up latency p50 %.1f us, p99 %.1f us over %lu stamped reports\n",
+            int_lat_quantile(0.5, woken) / 1e3, int_lat_quantile(0.99, woken) / 1e3, woken);
+}
+
+// driver stdout, batched into writevs (outq.h)
+struct outq out;
+
+// optional canonical mode (-l): keys are edited into a line that goes out
+// on Enter. The line is handed out in place and the buffer is reused by
+// the next key, so it is flushed at once.
+int canonical = 0;
+struct ldisc ldisc;
+
+void line_done(const char* line, size_t len, void* arg) {
+    outq_ref(&out, line, len);
+    outq_flush(&out);
+}
+
 void print_char(char ch) {
     if (capslock_state && ch >= 'a' && ch <= 'z')
         ch = ch - 'a' + 'A';
-    printf("%c", ch);
-    fflush(stdout);
+    if (canonical) ld_key(&ldisc, ch, line_done, NULL);
+    else outq_char(&out, ch);
+}
+
+// optional macro expansion (-M) on the output path; expansions go to the
+// writer by reference into the macro arena
+const char* mac_path = NULL;
+struct macros macros;
+
+void mac_put(char ch, void* arg) {
+    print_char(ch);
+}
+
+void mac_ref(const char* p, size_t len, void* arg) {
+    if (canonical) ld_insert(&ldisc, p, len);
+    else outq_ref(&out, p, len);
 }
 
 // input event callback
@@ -60,88 +291,203 @@ void usb_kbd_event(struct input_dev* dev_ptr) {
         capslock_state = 0;
     }
 
-    // update led
-    *(kbd.leds) = dev_ptr->led ? LED_ON : LED_OFF;
+    // update led: the state is a single byte, so a release store publishes
+    // it whole, and the listener's acquire load sees everything before it
+    __atomic_store_n(kbd.leds, dev_ptr->led ? LED_ON : LED_OFF, __ATOMIC_RELEASE);
+    // the listener prints to the same stdout, keys typed so far go first
+    outq_flush(&out);
     // control command
     write(kbd.ctrl_cmd_fd, "C", 1);
     // wait for ack
     char ack;
-    read(kbd.ctrl_ack_fd, &ack, 1);
+    lockstat_read(&ctrl_ack_stat, kbd.ctrl_ack_fd, &ack, 1);
 
 }
 
-// irq handler
-void* usb_kbd_irq(void* arg) {
-    char ch = *(char*)arg;
-    free(arg);
+// a key press that made it through debounce
+void usb_kbd_press(int usage, int mods, void* arg) {
+    struct input_dev* dev = arg;
+    if (usage == KEV_USAGE_CAPSLOCK) {
+        if (mac_path) mac_flush(&macros, mac_put, NULL);
+        input_report_key(&kbd, CAPSLOCK_PRESS, dev->led == LED_ON ? LED_OFF : LED_ON);
+        if (hk_path) hk_feed(&hotkeys, CAPSLOCK_PRESS);
+        return;
+    }
+    struct kev_event ev = { 0, usage, mods, 0 };
+    int ch = kev_to_char(&ev);
+    if (ch <= 0) return;
+    if (mac_path) mac_feed(&macros, ch, mac_put, mac_ref, NULL);
+    else print_char(ch);
+    if (hk_path) hk_feed(&hotkeys, ch);
+}
 
-    if (ch == CAPSLOCK_PRESS) {
-        input_report_key(&kbd, CAPSLOCK_PRESS, kbd.dev->led == LED_ON ? LED_OFF : LED_ON);
+// press/release of one usage, off the diff of the device's key bitmap
+void usb_kbd_key(int usage, int pressed, void* arg) {
+    struct input_dev* dev = arg;
+    if (!pressed) {
+        if (deb_mode) deb_release(&dev->deb, usage);
+        return;
     }
-    else if (ch != CAPSLOCK_RELEASE) {
+    int mods = keybits_mods(&dev->keys);
+    if (deb_mode && !deb_press(&dev->deb, usage, mods, usb_kbd_press, dev)) return;
+    usb_kbd_press(usage, mods, dev);
+}
+
+// irq handler, runs in arrival order on the reader so that replaying
+// faster than real time can't reorder keys and LED events
+void usb_kbd_irq(char ch) {
+    // every report is a poll for the debounce timers
+    if (deb_mode) {
+        deb_tick(&kbd.dev->deb, usb_kbd_press, kbd.dev);
+        // an idle report still lets go of the keys the last one named
+        if (ch == NO_EVENT) {
+            keybits_char(&kbd.dev->keys, ch, usb_kbd_key, kbd.dev);
+            return;
+        }
+    }
+    // codes with no key behind them go straight through
+    if (!keybits_char(&kbd.dev->keys, ch, usb_kbd_key, kbd.dev)) {
+        if (deb_mode) deb_flush(&kbd.dev->deb, usb_kbd_press, kbd.dev);
+        if (mac_path) mac_flush(&macros, mac_put, NULL);
         print_char(ch);
     }
-
-    return NULL;
 }
 
 // key events
 void input_report_key(struct usb_kbd* kbd, unsigned int code, int value) {
     if (code == CAPSLOCK_PRESS || code == CAPSLOCK_RELEASE) {
         kbd->dev->led = value;
-        pthread_t tid;
-        pthread_create(&tid, NULL, (void*)kbd->dev->event, kbd->dev);
-        pthread_detach(tid);
+        kbd->dev->event(kbd->dev);
     }
 }
 
-int driver() { // covers driver main, usb_kbd_open, usb_submit_urb
+// output is held until the endpoint runs dry, so a burst of keys goes out
+// in one writev. The bytes known to be readable are counted down, so the
+// endpoint is only asked again once they have been read.
+unsigned long int_ready = 0;
+
+void flush_if_idle() {
+    if (!outq_pending(&out)) return;
+    if (!int_ready) {
+        int avail = 0;
+        if (use_ring) avail = ring_avail(ring);
+        else ioctl(kbd.int_ep_fd, FIONREAD, &avail);
+        int_ready = avail;
+    }
+    if (!int_ready) outq_flush(&out);
+}
+
+// interrupt endpoint reader: dispatches inline, or hands keys to the queue
+// with -q. Recording stays here so captures keep the arrival timing.
+void* int_ep_reader(void* arg) {
+    while (1) {
+        char ch;
+        if (!evq_size) flush_if_idle();
+        if (int_ready) int_ready--;
+        ssize_t n = int_ep_read(&ch);
+        if (n <= 0) break;
+        if (rec_file) record_key(ch);
 
-    int int_pipe[2], ctrl_cmd_pipe[2], ctrl_ack_pipe[2];
-    kbd.int_ep_fd = open("int_pipe", O_RDONLY);
-    kbd.ctrl_cmd_fd = open("ctrl_cmd_pipe", O_WRONLY);
-    kbd.ctrl_ack_fd = open("ctrl_ack_pipe", O_RDONLY);
+        if (evq_size) {
+            evq_push(&int_queue, ch);
+            continue;
+        }
+        if (ch == NO_EVENT && !deb_mode) continue;
 
-    if (kbd.int_ep_fd < 0 || kbd.ctrl_cmd_fd < 0 || kbd.ctrl_ack_fd < 0) {
-        perror("pipe open failed");
-        exit(1);
+        usb_kbd_irq(ch);
     }
+    if (evq_size) evq_close(&int_queue);
+    return NULL;
+}
+
+int driver() { // covers driver main, usb_kbd_open, usb_submit_urb
+
+    aff_pin(AFF_READER);
+
+    // the driver's ends of the endpoints; the simulator's are closed so
+    // that it closing int_pipe reads as end of input
+    close(int_pipe[1]);
+    close(ctrl_cmd_pipe[0]);
+    close(ctrl_ack_pipe[1]);
+    kbd.int_ep_fd = int_pipe[0];
+    kbd.ctrl_cmd_fd = ctrl_cmd_pipe[1];
+    kbd.ctrl_ack_fd = ctrl_ack_pipe[0];
 
     // shared mem for led :D
-    int shm_fd = shm_open(SHM_NAME, O_RDWR, 0666);
-    if (shm_fd == -1) {
-        perror("shm_open failed");
-        exit(1);
-    }
+    kbd.leds = shared_leds;
 
-    kbd.leds = mmap(0, LED_BUF_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    if (kbd.leds == MAP_FAILED) {
-        perror("mmap failed");
-        exit(1);
+    lockstat_init();
+    lockstat_thread("driver");
+
+    if (spin_budget_ns && !use_ring)
+        fcntl(kbd.int_ep_fd, F_SETFL, fcntl(kbd.int_ep_fd, F_GETFL) | O_NONBLOCK);
+
+    if (rec_path) {
+        rec_file = fopen(rec_path, "w");
+        if (!rec_file) {
+            perror("unable to open recording");
+            exit(1);
+        }
+        unsigned char header[KEV_HEADER_SIZE];
+        kev_header(header);
+        fwrite(header, 1, KEV_HEADER_SIZE, rec_file);
     }
 
-    pthread_mutex_init(&kbd.leds_lock, NULL);
     input_dev* dev = malloc(sizeof(input_dev));
     dev->event = usb_kbd_event;
     dev->led = LED_OFF;
+    keybits_init(&dev->keys);
+    deb_init(&dev->deb, deb_mode, deb_window);
+
+    if (hk_path) {
+        hk_init(&hotkeys);
+        if (hk_load(&hotkeys, hk_path) < 0) {
+            perror("unable to open hotkeys");
+            exit(1);
+        }
+        hk_subscribe(&hotkeys, hotkey_matched, NULL);
+    }
     kbd.dev = dev;
 
-    // usb_kbd_open
-    while (1) {
-        char ch;
-        ssize_t n = read(kbd.int_ep_fd, &ch, 1);
-        if (n <= 0) break;
-
-        if (ch == NO_EVENT) continue;
+    outq_init(&out, STDOUT_FILENO);
+    ld_init(&ldisc);
+    if (mac_path && mac_load(&macros, mac_path) < 0) {
+        perror("unable to load macros");
+        exit(1);
+    }
 
-        char* pch = malloc(1);
-        *pch = ch;
-        pthread_t irq_thread;
-        pthread_create(&irq_thread, NULL, usb_kbd_irq, pch);
-        pthread_detach(irq_thread);
+    // usb_kbd_open
+    pthread_t reader;
+    if (evq_size) {
+        evq_init(&int_queue, evq_size, evq_policy, NO_EVENT);
+        pthread_create(&reader, NULL, int_ep_reader, NULL);
+        int ev;
+        while (1) {
+            if (evq_empty(&int_queue)) outq_flush(&out);
+            if ((ev = evq_pop(&int_queue)) < 0) break;
+            if (ev == NO_EVENT && !deb_mode) continue;
+            usb_kbd_irq(ev);
+        }
+        pthread_join(reader, NULL);
     }
+    else int_ep_reader(NULL);
+    if (deb_mode) deb_flush(&dev->deb, usb_kbd_press, dev);
+    if (mac_path) mac_flush(&macros, mac_put, NULL);
+    if (canonical) ld_flush(&ldisc, line_done, NULL);
+    outq_flush(&out);
     //printf("\n"); // if there is no newline at end of file, uncomment this :)
-    
+    lockstat_dump("driver exit");
+    if (rec_file) fclose(rec_file);
+    if (spin_budget_ns) print_poll_stats();
+    if (evq_size) evq_print_stats(&int_queue);
+    if (deb_mode) deb_print_stats(&dev->deb);
+    if (hk_path) hk_print_stats(&hotkeys);
+    if (mac_path) {
+        mac_print_stats(&macros);
+        outq_print_stats(&out);
+    }
+    if (canonical) ld_print_stats(&ldisc);
+
     return 0;
 }
 
@@ -149,23 +495,20 @@ void* control_listener(void* arg) {
     unsigned char* leds = (unsigned char*)arg;
     int prev_state = LED_OFF;
 
-    int ctrl_cmd_fd = open("ctrl_cmd_pipe", O_RDONLY);
-    int ctrl_ack_fd = open("ctrl_ack_pipe", O_WRONLY);
-
-    if (ctrl_cmd_fd < 0 || ctrl_ack_fd < 0) {
-        perror("failed to open pipe");
-        exit(1);
-    }
+    aff_pin(AFF_LISTENER);
+    int ctrl_cmd_fd = ctrl_cmd_pipe[0];
+    int ctrl_ack_fd = ctrl_ack_pipe[1];
 
     while (1) {
         char cmd;
         if (read(ctrl_cmd_fd, &cmd, 1) <= 0) break;
 
         if (cmd == 'C') {
-            int curr = *leds;
+            int curr = __atomic_load_n(leds, __ATOMIC_ACQUIRE);
             if (curr != prev_state) {
                 if (curr == LED_ON) printf("ON ");
                 else printf("OFF ");
+                fflush(stdout);
             }
             
             prev_state = curr;
@@ -178,65 +521,377 @@ void* control_listener(void* arg) {
     return NULL;
 }
 
+// mapped before fork so the driver inherits it
+struct kbd_ring* create_ring() {
+    struct kbd_ring* r = mmap(0, sizeof(struct kbd_ring), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED) {
+        perror("mmap ring failed");
+        exit(1);
+    }
+    aff_bind(r, sizeof(struct kbd_ring));
+    ring_init(r);
+    return r;
+}
+
+void int_ep_write(int fd, char ch) {
+    if (int_stamps) int_stamps[int_sent++ % INT_STAMPS] = now_ns();
+    if (use_ring) ring_write(ring, &ch, 1);
+    else write(fd, &ch, 1);
+}
+
+// replay speed: 1 is real time, N is N times faster, 0 is as fast as the
+// endpoint takes keys
+double speed = 1.0;
+
+// polling interval for text input, one report per interval: 20 ms by
+// default, or bInterval-style from a rate (-i 1000, -i 8000)
+unsigned long long poll_interval_ns = 20000000;
+int poll_stats = 0;
+
+// pacing runs on absolute deadlines: each report is due a fixed time after
+// the previous one was due, not after it went out, so a late wakeup doesn't
+// push back everything behind it. Lateness is how far past its deadline a
+// report was sent.
+struct {
+    struct timespec next;
+    unsigned long reports;
+    unsigned long overruns;         // sent an interval or more late
+    unsigned long long first_ns;
+    unsigned long long last_ns;
+    double late_sum;
+    double late_sq;
+    unsigned long long late_max;
+} pacer;
+
+void pace(unsigned long long ns) {
+    if (speed <= 0) return;
+
+    if (!pacer.reports) {
+        // the first report goes out now
+        clock_gettime(CLOCK_MONOTONIC, &pacer.next);
+    }
+    else {
+        unsigned long long step = ns / speed;
+        pacer.next.tv_sec += (pacer.next.tv_nsec + step) / 1000000000;
+        pacer.next.tv_nsec = (pacer.next.tv_nsec + step) % 1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &pacer.next, NULL) == EINTR);
+    }
+
+    unsigned long long t = now_ns();
+    unsigned long long due = pacer.next.tv_sec * 1000000000ull + pacer.next.tv_nsec;
+    unsigned long long late = t > due ? t - due : 0;
+    if (!pacer.reports) pacer.first_ns = due;
+    pacer.last_ns = t;
+    pacer.reports++;
+    pacer.late_sum += late;
+    pacer.late_sq += (double)late * late;
+    if (late > pacer.late_max) pacer.late_max = late;
+    if (ns && pacer.reports > 1 && late >= ns / speed) pacer.overruns++;
+}
+
+void print_pace_stats() {
+    if (pacer.reports < 2) return;
+    double mean = pacer.late_sum / pacer.reports;
+    double sd = sqrt(pacer.late_sq / pacer.reports - mean * mean);
+    double secs = (pacer.last_ns - pacer.first_ns) / 1e9;
+    double nominal = 1e9 * speed / poll_interval_ns;
+
+    fprintf(stderr, "\npacing: %lu reports, %.1f Hz achieved of %.1f Hz nominal, "
+        "lateness mean %.1f us sd %.1f us max %.1f us, %lu overruns\n",
+        pacer.reports, (pacer.reports - 1) / secs, nominal, mean / 1e3, sd / 1e3, pacer.late_max / 1e3,
+        pacer.overruns);
+}
+
+// replays a KEV capture with its recorded timing
+void stream_kev(FILE* file, int fd) {
+    struct stat st;
+    fstat(fileno(file), &st);
+    unsigned char* data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    if (data == MAP_FAILED) {
+        perror("mmap input failed");
+        exit(1);
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    const unsigned char* p = data + KEV_HEADER_SIZE;
+    const unsigned char* end = data + st.st_size;
+    struct kev_event ev;
+    size_t n;
+    unsigned long long wait = 0;
+
+    // records with no wire code (releases) aren't reports: their delay
+    // carries over to the next one that is sent
+    while ((n = kev_decode(p, end, &ev))) {
+        p += n;
+        wait += ev.delta_us * 1000ull;
+        int ch = kev_to_char(&ev);
+        if (ch < 0) continue;
+        pace(wait);
+        wait = 0;
+        int_ep_write(fd, ch);
+    }
+    munmap(data, st.st_size);
+}
+
+// key matrix load source (-k): the text is typed on a simulated matrix
+// (matrix.h) and every scan, one per polling interval, sends the wire codes
+// for what changed, or NO_EVENT when nothing did
+int use_matrix = 0;
+
+void stream_matrix(FILE* file, int fd) {
+    struct stat st;
+    fstat(fileno(file), &st);
+    char* data = st.st_size ? mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0) : NULL;
+    if (data == MAP_FAILED) {
+        perror("mmap input failed");
+        exit(1);
+    }
+
+    struct kbd_matrix m;
+    struct mx_typist t;
+    char out[MX_MAX_EVENTS];
+    mx_init(&m, 1);
+    mx_typist_init(&t, data, st.st_size, MX_GAP, MX_HOLD);
+
+    while (mx_type(&t, &m)) {
+        pace(poll_interval_ns);
+        int n = mx_scan(&m, out);
+        if (!n) int_ep_write(fd, NO_EVENT);
+        for (int i = 0; i < n; i++) int_ep_write(fd, out[i]);
+    }
+    if (data) munmap(data, st.st_size);
+
+    if (poll_stats)
+        fprintf(stderr, "\nmatrix: %lu scans, %lu events, %lu bounces, %lu ambiguous scans, %lu presses held back\n",
+            m.scans, m.events, m.bounces, m.ghost_scans, m.ghost_blocked);
+}
+
+// bulk feed (-b): a text input pushed whole and unpaced into the endpoint,
+// with buffered writes, splice from the file, or vmsplice from a mapping of
+// it, so the keys aren't copied through the simulator. The last two need
+// the FIFO transport. The driver still reads key by key, so once the input
+// is larger than the pipe the reported rate is the driver's; feedbench
+// measures the feed on its own.
+#define FEED_PACED    0
+#define FEED_WRITE    1
+#define FEED_SPLICE   2
+#define FEED_VMSPLICE 3
+
+const char* feed_names[] = { "paced", "write", "splice", "vmsplice" };
+int feed_mode = FEED_PACED;
+
+void feed_bulk(FILE* file, int fd) {
+    int in = fileno(file);
+    struct stat st;
+    fstat(in, &st);
+    size_t size = st.st_size, sent = 0;
+    unsigned long long start = now_ns();
+
+    if (feed_mode == FEED_WRITE) {
+        char buf[65536];
+        ssize_t n;
+        lseek(in, 0, SEEK_SET);
+        while ((n = read(in, buf, sizeof(buf))) > 0) {
+            if (use_ring) ring_write(ring, buf, n);
+            else for (ssize_t w = 0; w < n;) {
+                ssize_t r = write(fd, buf + w, n - w);
+                if (r < 0) {
+                    if (errno == EINTR) continue;
+                    perror("write failed");
+                    exit(1);
+                }
+                w += r;
+            }
+            sent += n;
+        }
+    }
+    else if (feed_mode == FEED_SPLICE) {
+        loff_t off = 0;
+        while (sent < size) {
+            ssize_t n = splice(in, &off, fd, NULL, size - sent, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (n <= 0) {
+                perror("splice failed");
+                exit(1);
+            }
+            sent += n;
+        }
+    }
+    else if (size) {
+        char* data = mmap(0, size, PROT_READ, MAP_PRIVATE, in, 0);
+        if (data == MAP_FAILED) {
+            perror("mmap input failed");
+            exit(1);
+        }
+        madvise(data, size, MADV_SEQUENTIAL);
+        while (sent < size) {
+            struct iovec iov = { data + sent, size - sent };
+            ssize_t n = vmsplice(fd, &iov, 1, 0);
+            if (n <= 0) {
+                perror("vmsplice failed");
+                exit(1);
+            }
+            sent += n;
+        }
+        // the pipe holds its own references to the pages
+        munmap(data, size);
+    }
+
+    double secs = (now_ns() - start) / 1e9;
+    fprintf(stderr, "\nfeed: %zu bytes by %s in %.3f ms, %.4f GB/s\n", sent, feed_names[feed_mode],
+        secs * 1e3, secs > 0 ? sent / secs / 1e9 : 0.0);
+}
+
+void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-t fifo|ring] [-p spin_us] [-r record.kev] [-s speed] [-i poll_hz] [-k] [-l]\n"
+        "          [-a reader=cpu,listener=cpu,sim=cpu] [-m mem_node]\n"
+        "          [-q depth[:block|drop|coalesce]] [-b write|splice|vmsplice]\n"
+        "          [-d eager|deferred[:polls]] [-H hotkeys.conf]\n"
+        "          [-M macros.txt|macros.img]\n"
+        "          <input_file|capture.kev>\n", prog);
+    exit(1);
+}
+
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s <input_file>\n", argv[0]);
+    int opt;
+    while ((opt = getopt(argc, argv, "t:p:r:s:a:m:q:b:i:d:H:M:kl")) != -1) {
+        switch (opt) {
+        case 't':
+            if (!strcmp(optarg, "ring")) use_ring = 1;
+            else if (strcmp(optarg, "fifo")) usage(argv[0]);
+            break;
+        case 'p':
+            spin_budget_ns = atol(optarg) * 1000;
+            break;
+        case 'r':
+            rec_path = optarg;
+            break;
+        case 's':
+            speed = atof(optarg);
+            break;
+        case 'k':
+            use_matrix = 1;
+            break;
+        case 'l':
+            canonical = 1;
+            break;
+        case 'i':
+            if (atol(optarg) <= 0) usage(argv[0]);
+            poll_interval_ns = 1000000000ull / atol(optarg);
+            poll_stats = 1;
+            break;
+        case 'a':
+            if (aff_parse(optarg) < 0) usage(argv[0]);
+            break;
+        case 'm':
+            aff_node = atoi(optarg);
+            break;
+        case 'q':
+            if (evq_parse(optarg, &evq_size, &evq_policy) < 0) usage(argv[0]);
+            break;
+        case 'd':
+            if (deb_parse(optarg, &deb_mode, &deb_window) < 0) usage(argv[0]);
+            break;
+        case 'H':
+            hk_path = optarg;
+            break;
+        case 'M':
+            mac_path = optarg;
+            break;
+        case 'b':
+            feed_mode = FEED_PACED;
+            for (int i = FEED_WRITE; i <= FEED_VMSPLICE; i++)
+                if (!strcmp(optarg, feed_names[i])) feed_mode = i;
+            if (feed_mode == FEED_PACED) usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind >= argc) usage(argv[0]);
+    if (use_ring && feed_mode > FEED_WRITE) {
+        fprintf(stderr, "%s: -b %s needs the fifo transport\n", argv[0], feed_names[feed_mode]);
         exit(1);
     }
+    // the debounce window is counted in idle reports, which drop and
+    // coalesce exist to throw away
+    if (deb_mode && evq_policy != EVQ_BLOCK) {
+        fprintf(stderr, "%s: -d needs every idle report, -q %s blocks instead\n", argv[0], evq_policy_name[evq_policy]);
+        evq_policy = EVQ_BLOCK;
+    }
+    aff_check();
 
     // creating pipes for the endpoints
-    mkfifo("int_pipe", 0666);
-    mkfifo("ctrl_cmd_pipe", 0666);
-    mkfifo("ctrl_ack_pipe", 0666);
-    
-    // start separate driver process
-    pid_t pid = fork();
-    if (pid < 0) return -1;
-    if (pid == 0) return driver();
-
-    int int_pipe_fd = open("int_pipe", O_WRONLY);
-    if (int_pipe_fd < 0) {
-        perror("can't open pipe int_pipe");
+    if (pipe(int_pipe) < 0 || pipe(ctrl_cmd_pipe) < 0 || pipe(ctrl_ack_pipe) < 0) {
+        perror("pipe failed");
         exit(1);
     }
+    if (use_ring) ring = create_ring();
+    if (spin_budget_ns) {
+        int_stamps = mmap(0, INT_STAMPS * sizeof(*int_stamps), PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (int_stamps == MAP_FAILED) {
+            perror("mmap stamps failed");
+            exit(1);
+        }
+    }
 
     // shared mem led buf
-    int shm_fd = shm_open(SHM_NAME, O_CREAT | O_RDWR, 0666);
-    ftruncate(shm_fd, LED_BUF_SIZE);
-    unsigned char* leds = mmap(0, LED_BUF_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    unsigned char* leds = mmap(0, LED_BUF_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
     if (leds == MAP_FAILED) {
         perror("mmap failed");
         exit(1);
     }
+    aff_bind(leds, LED_BUF_SIZE);
 
     *leds = LED_OFF;
+    shared_leds = leds;
+    
+    // start separate driver process
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) return driver();
+    aff_pin(AFF_SIM);
+
+    close(int_pipe[0]);
+    close(ctrl_cmd_pipe[1]);
+    close(ctrl_ack_pipe[0]);
+    int int_pipe_fd = int_pipe[1];
 
     pthread_t ctrl_thread;
     pthread_create(&ctrl_thread, NULL, control_listener, leds);
 
     // getting input from file
-    FILE* file = fopen(argv[1], "r");
+    FILE* file = fopen(argv[optind], "r");
     if (!file) {
         perror("unable to open input file");
         exit(1);
     }
 
-    char ch;
-    while ((ch = fgetc(file)) != EOF) {
-        write(int_pipe_fd, &ch, 1);
-        usleep(20000); // delay, letters get jumbled otherwise :(
+    char magic[KEV_HEADER_SIZE];
+    size_t got = fread(magic, 1, KEV_HEADER_SIZE, file);
+    rewind(file);
+
+    if (kev_is_file(magic, got)) stream_kev(file, int_pipe_fd);
+    else if (use_matrix) stream_matrix(file, int_pipe_fd);
+    else if (feed_mode != FEED_PACED) feed_bulk(file, int_pipe_fd);
+    else {
+        char ch;
+        while ((ch = fgetc(file)) != EOF) {
+            pace(poll_interval_ns);
+            int_ep_write(int_pipe_fd, ch);
+        }
     }
 
     fclose(file);
+    if (poll_stats) print_pace_stats();
+    if (use_ring) ring_close(ring);
     close(int_pipe_fd);
     pthread_join(ctrl_thread, NULL);
 
     munmap(leds, LED_BUF_SIZE);
-    shm_unlink(SHM_NAME);
-
-    unlink("int_pipe");
-    unlink("ctrl_cmd_pipe");
-    unlink("ctrl_ack_pipe");
+    if (use_ring) munmap(ring, sizeof(struct kbd_ring));
+    if (int_stamps) munmap(int_stamps, INT_STAMPS * sizeof(*int_stamps));
 
     return 0;
 }
@@ -4,10 +4,15 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
+#include <poll.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <coroutine>
+#include <cstddef>
+#include <new>
+
 #define LED_BUF_SIZE 1
 
 #define NO_EVENT        '#'
@@ -17,6 +22,186 @@
 #define LED_ON  1
 #define LED_OFF 0
 
+// URB COMPLETION MODEL
+//
+// The driver runs on one thread. Each endpoint transfer is an urb that a
+// coroutine submits with `co_await submit(&urb)`; the coroutine is suspended
+// until the event loop has polled the endpoint, done the transfer and
+// resumed it with the transferred length. Coroutines hand work to each
+// other through urb_events. Frames come from a fixed pool, so a running
+// driver does no allocation per key or per URB.
+
+#define URB_IN  0   // endpoint to driver
+#define URB_OUT 1   // driver to endpoint
+
+struct urb {
+    int fd;
+    int dir;        // URB_IN or URB_OUT
+    char* buf;
+    size_t len;
+    ssize_t actual; // bytes transferred, <= 0 when the endpoint is gone
+    std::coroutine_handle<> waiter;
+};
+
+#define MAX_PENDING_URBS 8
+#define MAX_READY        8
+
+struct urb_loop {
+    urb* pending[MAX_PENDING_URBS];
+    int npending;
+    std::coroutine_handle<> ready[MAX_READY];   // resumed on the next turn
+    int nready;
+    long completions;
+};
+
+urb_loop loop;
+
+void loop_schedule(std::coroutine_handle<> h) {
+    if (loop.nready == MAX_READY) {
+        fprintf(stderr, "driver: too many runnable coroutines\n");
+        abort();
+    }
+    loop.ready[loop.nready++] = h;
+}
+
+// Runs until no coroutine is waiting on an endpoint or runnable
+void loop_run() {
+    struct pollfd pfds[MAX_PENDING_URBS];
+
+    while (loop.nready || loop.npending) {
+        while (loop.nready) {
+            std::coroutine_handle<> h = loop.ready[0];
+            memmove(loop.ready, loop.ready + 1, --loop.nready * sizeof(loop.ready[0]));
+            h.resume();
+        }
+        if (!loop.npending) break;
+
+        for (int i = 0; i < loop.npending; i++) {
+            pfds[i].fd = loop.pending[i]->fd;
+            pfds[i].events = loop.pending[i]->dir == URB_IN ? POLLIN : POLLOUT;
+            pfds[i].revents = 0;
+        }
+        if (poll(pfds, loop.npending, -1) < 0) {
+            perror("poll failed");
+            exit(1);
+        }
+
+        // complete in submission order, the ones that are ready
+        int n = loop.npending, kept = 0;
+        urb* done[MAX_PENDING_URBS];
+        int ndone = 0;
+        for (int i = 0; i < n; i++) {
+            urb* u = loop.pending[i];
+            if (!pfds[i].revents) {
+                loop.pending[kept++] = u;
+                continue;
+            }
+            u->actual = u->dir == URB_IN ? read(u->fd, u->buf, u->len) : write(u->fd, u->buf, u->len);
+            done[ndone++] = u;
+        }
+        loop.npending = kept;
+        for (int i = 0; i < ndone; i++) {
+            loop.completions++;
+            done[i]->waiter.resume();
+        }
+    }
+}
+
+struct urb_submit {
+    urb* u;
+
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> h) {
+        if (loop.npending == MAX_PENDING_URBS) {
+            fprintf(stderr, "driver: too many URBs in flight\n");
+            abort();
+        }
+        u->waiter = h;
+        loop.pending[loop.npending++] = u;
+    }
+    ssize_t await_resume() { return u->actual; }
+};
+
+urb_submit submit(urb* u) {
+    return urb_submit{ u };
+}
+
+// One-shot handoff between coroutines, awaited with `co_await wait(&ev)`:
+// signal() before the wait makes it return at once, signal() after it
+// schedules the waiter
+struct urb_event {
+    std::coroutine_handle<> waiter;
+    int signaled;
+};
+
+void signal(urb_event* ev) {
+    if (!ev->waiter) {
+        ev->signaled = 1;
+        return;
+    }
+    std::coroutine_handle<> h = ev->waiter;
+    ev->waiter = nullptr;
+    loop_schedule(h);
+}
+
+struct urb_wait {
+    urb_event* ev;
+
+    bool await_ready() {
+        if (!ev->signaled) return false;
+        ev->signaled = 0;
+        return true;
+    }
+    void await_suspend(std::coroutine_handle<> h) { ev->waiter = h; }
+    void await_resume() {}
+};
+
+urb_wait wait(urb_event* ev) {
+    return urb_wait{ ev };
+}
+
+// Coroutine frames, from a fixed pool of slots instead of the heap
+#define FRAME_SLOT_SIZE 512
+#define FRAME_SLOTS     4
+
+alignas(std::max_align_t) unsigned char frame_pool[FRAME_SLOTS][FRAME_SLOT_SIZE];
+int frame_used[FRAME_SLOTS];
+
+void* frame_alloc(size_t size) {
+    for (int i = 0; i < FRAME_SLOTS && size <= FRAME_SLOT_SIZE; i++) {
+        if (frame_used[i]) continue;
+        frame_used[i] = 1;
+        return frame_pool[i];
+    }
+    return nullptr;
+}
+
+void frame_free(void* p) {
+    frame_used[((unsigned char*)p - frame_pool[0]) / FRAME_SLOT_SIZE] = 0;
+}
+
+struct urb_task {
+    struct promise_type {
+        urb_task get_return_object() { return urb_task{ std::coroutine_handle<promise_type>::from_promise(*this) }; }
+        static urb_task get_return_object_on_allocation_failure() { return urb_task{ nullptr }; }
+        std::suspend_never initial_suspend() { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { abort(); }
+
+        static void* operator new(size_t size) noexcept { return frame_alloc(size); }
+        static void operator delete(void* p) { frame_free(p); }
+    };
+
+    std::coroutine_handle<promise_type> h;
+
+    bool started() { return (bool)h; }
+    void destroy() {
+        if (h) h.destroy();
+        h = nullptr;
+    }
+};
+
 struct input_dev {
     void (*event)(struct input_dev* dev);
     int led;
@@ -31,19 +216,32 @@ struct usb_kbd {
 
     unsigned char* leds;
 
-    pthread_mutex_t leds_lock;
+    // URBs for the endpoints, and their buffers
+    urb irq;
+    urb ctrl_cmd;
+    urb ctrl_ack;
+    char irq_buf;
+    char ctrl_cmd_buf;
+    char ctrl_ack_buf;
+
+    urb_event led_request;  // LED state changed, send it
+    urb_event led_done;     // the keyboard acknowledged it
+    int closing;
 };
 
 typedef struct usb_kbd usb_kbd;
 typedef struct input_dev input_dev;
 
-void input_report_key(struct usb_kbd* kbd, unsigned int code, int value);
+urb_wait input_report_key(struct usb_kbd* kbd, unsigned int code, int value);
 
 // DRIVER
 
-#define SHM_NAME "/led_shm"
-
 usb_kbd kbd;
+
+// Endpoints and LED buffer, created in main before the fork so each run
+// gets its own. Pipe ends: [0] read, [1] write.
+int int_pipe[2], ctrl_cmd_pipe[2], ctrl_ack_pipe[2];
+unsigned char* shared_leds;
 int capslock_state = 0;
 
 void print_char(char ch) {
@@ -56,17 +254,8 @@ void print_char(char ch) {
     fflush(stdout);
 }
 
-// Simulated input_event callback
+// Simulated input_event callback, once the keyboard has acknowledged the LEDs
 void usb_kbd_event(struct input_dev* dev_ptr) {
-    // Send control command
-    write(kbd.ctrl_cmd_fd, "C", 1);
-    // Write new LED state to shared memory
-    *(kbd.leds) = dev_ptr->led ? LED_ON : LED_OFF;
-
-    // Wait for ACK
-    char ack;
-    read(kbd.ctrl_ack_fd, &ack, 1);
-
     if (dev_ptr->led == LED_ON && !capslock_state) {
         capslock_state = 1;
         printf("\nON\n");
@@ -77,90 +266,107 @@ void usb_kbd_event(struct input_dev* dev_ptr) {
     }
 }
 
-// Simulated irq handler
-void* usb_kbd_irq(void* arg) {
-    char ch = *(char*)arg;
-    free(arg);
+// Simulated LED handler: sends every LED change on the control endpoint
+urb_task usb_kbd_led(usb_kbd* kbd) {
+    while (1) {
+        co_await wait(&kbd->led_request);
+        if (kbd->closing) break;
+
+        // Write new LED state to shared memory, then send control command
+        __atomic_store_n(kbd->leds, kbd->dev->led ? LED_ON : LED_OFF, __ATOMIC_RELEASE);
+        kbd->ctrl_cmd_buf = 'C';
+        // g++ 12 miscompiles a co_await inside an if condition that breaks
+        // out of the loop, so the length goes through a variable
+        ssize_t n = co_await submit(&kbd->ctrl_cmd);
+        if (n <= 0) break;
+
+        // Wait for ACK
+        n = co_await submit(&kbd->ctrl_ack);
+        if (n <= 0) break;
 
-    if (ch == CAPSLOCK_PRESS) {
-        input_report_key(&kbd, CAPSLOCK_PRESS, LED_ON);
+        kbd->dev->event(kbd->dev);
+        signal(&kbd->led_done);
     }
-    else if (ch == CAPSLOCK_RELEASE) {
-        input_report_key(&kbd, CAPSLOCK_RELEASE, LED_OFF);
-    }
-    else {
-        print_char(ch);
+    signal(&kbd->led_done);
+}
+
+// Simulated irq handler: one interrupt URB, resubmitted after every key
+urb_task usb_kbd_irq(usb_kbd* kbd) {
+    while (1) {
+        ssize_t n = co_await submit(&kbd->irq);
+        if (n <= 0) break;
+
+        char ch = kbd->irq_buf;
+        if (ch == NO_EVENT) continue;
+
+        if (ch == CAPSLOCK_PRESS) {
+            co_await input_report_key(kbd, CAPSLOCK_PRESS, LED_ON);
+        }
+        else if (ch == CAPSLOCK_RELEASE) {
+            co_await input_report_key(kbd, CAPSLOCK_RELEASE, LED_OFF);
+        }
+        else {
+            print_char(ch);
+        }
     }
 
-    return NULL;
+    kbd->closing = 1;
+    signal(&kbd->led_request);
 }
 
-// Report a key event
-void input_report_key(struct usb_kbd* kbd, unsigned int code, int value) {
+// Report a key event; the caller awaits the LED round trip it starts
+urb_wait input_report_key(struct usb_kbd* kbd, unsigned int code, int value) {
     if (code == CAPSLOCK_PRESS || code == CAPSLOCK_RELEASE) {
         kbd->dev->led = value;
-        pthread_t tid;
-        pthread_create(&tid, NULL, (void* (*)(void*))kbd->dev->event, kbd->dev);
-        pthread_detach(tid);
+        signal(&kbd->led_request);
     }
-}
-
-int driver() {
-    // Set up pipes
-    int int_pipe[2], ctrl_cmd_pipe[2], ctrl_ack_pipe[2];
-
-    // Pipes must be pre-created using dup/exec between processes or use fixed names
-    // For now, we'll use known names for FIFO-like behavior
-
-    // Assume these pipes are already created by keyboard process:
-    kbd.int_ep_fd = open("int_pipe", O_RDONLY);
-    kbd.ctrl_cmd_fd = open("ctrl_cmd_pipe", O_WRONLY);
-    kbd.ctrl_ack_fd = open("ctrl_ack_pipe", O_RDONLY);
-
-    if (kbd.int_ep_fd < 0 || kbd.ctrl_cmd_fd < 0 || kbd.ctrl_ack_fd < 0) {
-        perror("pipe open failed");
-        exit(1);
+    else {
+        signal(&kbd->led_done);
     }
+    return wait(&kbd->led_done);
+}
 
-    // Set up shared memory for LED buffer
-    int shm_fd = shm_open(SHM_NAME, O_RDWR, 0666);
-    if (shm_fd == -1) {
-        perror("shm_open failed");
-        exit(1);
-    }
+void init_urb(urb* u, int fd, int dir, char* buf) {
+    u->fd = fd;
+    u->dir = dir;
+    u->buf = buf;
+    u->len = 1;
+    u->actual = 0;
+    u->waiter = nullptr;
+}
 
-    kbd.leds = mmap(0, LED_BUF_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    if (kbd.leds == MAP_FAILED) {
-        perror("mmap failed");
-        exit(1);
-    }
+int driver() {
+    // The driver's ends of the pipes the keyboard process made
+    kbd.int_ep_fd = int_pipe[0];
+    kbd.ctrl_cmd_fd = ctrl_cmd_pipe[1];
+    kbd.ctrl_ack_fd = ctrl_ack_pipe[0];
+    kbd.leds = shared_leds;
 
     // Init usb_kbd fields
-    pthread_mutex_init(&kbd.leds_lock, NULL);
-    input_dev* dev = malloc(sizeof(input_dev));
+    input_dev* dev = (input_dev*)malloc(sizeof(input_dev));
     dev->event = usb_kbd_event;
     dev->led = LED_OFF;
     kbd.dev = dev;
 
+    init_urb(&kbd.irq, kbd.int_ep_fd, URB_IN, &kbd.irq_buf);
+    init_urb(&kbd.ctrl_cmd, kbd.ctrl_cmd_fd, URB_OUT, &kbd.ctrl_cmd_buf);
+    init_urb(&kbd.ctrl_ack, kbd.ctrl_ack_fd, URB_IN, &kbd.ctrl_ack_buf);
+
     // Call open (simulated)
     printf("Driver started. Listening to keyboard input...\n");
+    fflush(stdout);
 
-    while (1) {
-        char ch;
-        ssize_t n = read(kbd.int_ep_fd, &ch, 1);
-        if (n <= 0) break;
-
-        if (ch == NO_EVENT) continue;
-
-        char* pch = malloc(1);
-        *pch = ch;
-        pthread_t irq_thread;
-        pthread_create(&irq_thread, NULL, usb_kbd_irq, pch);
-        pthread_detach(irq_thread);
-
-        // Simulate short delay between polls
-        usleep(10000); // 10ms
+    urb_task led = usb_kbd_led(&kbd);
+    urb_task irq = usb_kbd_irq(&kbd);
+    if (!led.started() || !irq.started()) {
+        fprintf(stderr, "driver: no coroutine frame available\n");
+        exit(1);
     }
+    loop_run();
+
+    fprintf(stderr, "driver: %ld URB completions on 1 thread\n", loop.completions);
+    irq.destroy();
+    led.destroy();
 
     printf("\nDriver shutting down.\n");
     return 0;
@@ -177,20 +383,15 @@ int capslock_led_state = 0; // 0: OFF, 1: ON
 void* control_listener(void* arg) {
     unsigned char* leds = (unsigned char*)arg;
 
-    int ctrl_cmd_fd = open("ctrl_cmd_pipe", O_RDONLY);
-    int ctrl_ack_fd = open("ctrl_ack_pipe", O_WRONLY);
-
-    if (ctrl_cmd_fd < 0 || ctrl_ack_fd < 0) {
-        perror("keyboard: control pipe open failed");
-        exit(1);
-    }
+    int ctrl_cmd_fd = ctrl_cmd_pipe[0];
+    int ctrl_ack_fd = ctrl_ack_pipe[1];
 
     while (1) {
         char cmd;
         if (read(ctrl_cmd_fd, &cmd, 1) <= 0) break;
 
         if (cmd == 'C') {
-            if (*leds == LED_ON) {
+            if (__atomic_load_n(leds, __ATOMIC_ACQUIRE) == LED_ON) {
                 capslock_led_state = !capslock_led_state; // Toggle
             }
             // Just acknowledge either way
@@ -207,33 +408,39 @@ int main(int argc, char* argv[]) {
         exit(1);
     }
 
-    // added by me :)
-    pid_t pid = fork();
-    if (pid < 0) return -1;
-    if (pid == 0) return driver();
-
-    // Create pipes (simulate endpoints)
-    // These should match the names expected by driver
-    mkfifo("int_pipe", 0666);
-    mkfifo("ctrl_cmd_pipe", 0666);
-    mkfifo("ctrl_ack_pipe", 0666);
-
-    int int_pipe_fd = open("int_pipe", O_WRONLY);
-    if (int_pipe_fd < 0) {
-        perror("keyboard: can't open int_pipe");
+    // Create pipes (simulate endpoints); the driver inherits them
+    if (pipe(int_pipe) < 0 || pipe(ctrl_cmd_pipe) < 0 || pipe(ctrl_ack_pipe) < 0) {
+        perror("keyboard: pipe failed");
         exit(1);
     }
 
     // Create shared memory for LED buffer
-    int shm_fd = shm_open(SHM_NAME, O_CREAT | O_RDWR, 0666);
-    ftruncate(shm_fd, LED_BUF_SIZE);
-    unsigned char* leds = mmap(0, LED_BUF_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    unsigned char* leds = (unsigned char*)mmap(0, LED_BUF_SIZE, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
     if (leds == MAP_FAILED) {
         perror("keyboard: mmap failed");
         exit(1);
     }
 
     *leds = LED_OFF; // Initially OFF
+    shared_leds = leds;
+
+    // added by me :)
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        // only the driver's ends stay open, so each side sees EOF when the
+        // other closes
+        close(int_pipe[1]);
+        close(ctrl_cmd_pipe[0]);
+        close(ctrl_ack_pipe[1]);
+        return driver();
+    }
+
+    close(int_pipe[0]);
+    close(ctrl_cmd_pipe[1]);
+    close(ctrl_ack_pipe[0]);
+    int int_pipe_fd = int_pipe[1];
 
     // Start LED control listener thread
     pthread_t ctrl_thread;
@@ -257,11 +464,6 @@ int main(int argc, char* argv[]) {
     pthread_join(ctrl_thread, NULL);
 
     munmap(leds, LED_BUF_SIZE);
-    shm_unlink(SHM_NAME);
-
-    unlink("int_pipe");
-    unlink("ctrl_cmd_pipe");
-    unlink("ctrl_ack_pipe");
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,188 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// Parallel replay launcher.
+//
+// Runs N independent instances of one variant on the same input at once
+// and reports aggregate throughput, for 1, 2, 4, ... up to N instances so
+// the scaling with cores shows. With -p instance i is pinned to CPU
+// i % ncpu before exec; the variant's own threads inherit that, unless it
+// is given its own placement (keyboard -a). Every instance must print what
+// the first one did, or the run counts as failed: this is what catches
+// instances that still share a named FIFO or shm object.
+//
+// Only variants without named IPC (keyboard, kbd1) can run side by side.
+
+#define MAX_INSTANCES 1024
+#define MAX_OUTPUT    (16 << 20)
+
+struct instance {
+    pid_t pid;
+    int fd;
+    char* out;
+    size_t len;
+    int done;
+};
+
+double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// a variant is a binary, optionally followed by its own options
+void split_variant(const char* variant, const char* input, char* buf, size_t size, char** args) {
+    int nargs = 0;
+    snprintf(buf, size, "%s", variant);
+    for (char* tok = strtok(buf, " "); tok && nargs < 30; tok = strtok(NULL, " ")) args[nargs++] = tok;
+    args[nargs++] = (char*)input;
+    args[nargs] = NULL;
+}
+
+void start(struct instance* in, char** args, int cpu) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("pipe failed");
+        exit(1);
+    }
+    in->pid = fork();
+    if (in->pid < 0) {
+        perror("fork failed");
+        exit(1);
+    }
+    if (in->pid == 0) {
+        if (cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            sched_setaffinity(0, sizeof(set), &set);
+        }
+        setpgid(0, 0);
+        dup2(fds[1], 1);
+        close(fds[0]);
+        close(fds[1]);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, 2);
+        execv(args[0], args);
+        _exit(127);
+    }
+    close(fds[1]);
+    in->fd = fds[0];
+    in->out = malloc(MAX_OUTPUT + 1);
+    in->len = 0;
+    in->done = 0;
+}
+
+// runs n instances to completion, returns the number that failed
+int run(int n, char** args, int pin, int timeout, double* wall) {
+    static struct instance in[MAX_INSTANCES];
+    static struct pollfd pfd[MAX_INSTANCES];
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    double begin = now_sec();
+    for (int i = 0; i < n; i++) start(&in[i], args, pin ? i % ncpu : -1);
+
+    int running = n, failed = 0;
+    while (running) {
+        int left = timeout * 1000 - (int)((now_sec() - begin) * 1000);
+        if (left <= 0) break;
+
+        int np = 0;
+        int which[MAX_INSTANCES];
+        for (int i = 0; i < n; i++) {
+            if (in[i].done) continue;
+            pfd[np] = (struct pollfd){ in[i].fd, POLLIN, 0 };
+            which[np++] = i;
+        }
+        if (poll(pfd, np, left) <= 0) continue;
+
+        for (int j = 0; j < np; j++) {
+            if (!pfd[j].revents) continue;
+            struct instance* r = &in[which[j]];
+            ssize_t got = read(r->fd, r->out + r->len, MAX_OUTPUT - r->len);
+            if (got > 0) {
+                r->len += got;
+                continue;
+            }
+            r->done = 1;
+            running--;
+        }
+    }
+    *wall = now_sec() - begin;
+
+    for (int i = 0; i < n; i++) {
+        int status;
+        kill(-in[i].pid, SIGKILL);
+        waitpid(in[i].pid, &status, 0);
+        close(in[i].fd);
+
+        int ok = in[i].done && WIFEXITED(status) && WEXITSTATUS(status) == 0
+            && in[i].len == in[0].len && !memcmp(in[i].out, in[0].out, in[0].len);
+        if (!ok) {
+            if (failed == 0) fprintf(stderr, "  instance %d: %s\n", i, in[i].done ? "output differs or failed" : "hung");
+            failed++;
+        }
+    }
+    for (int i = 0; i < n; i++) free(in[i].out);
+    return failed;
+}
+
+int main(int argc, char* argv[]) {
+    int max = sysconf(_SC_NPROCESSORS_ONLN);
+    int pin = 0;
+    int timeout = 60;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:pt:")) != -1) {
+        switch (opt) {
+        case 'n': max = atoi(optarg); break;
+        case 'p': pin = 1; break;
+        case 't': timeout = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-n max_instances] [-p] [-t timeout_s] <variant> <input>\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (optind + 2 > argc || max < 1 || max > MAX_INSTANCES) {
+        fprintf(stderr, "Usage: %s [-n max_instances] [-p] [-t timeout_s] <variant> <input>\n", argv[0]);
+        exit(1);
+    }
+
+    char buf[1024];
+    char* args[32];
+    split_variant(argv[optind], argv[optind + 1], buf, sizeof(buf), args);
+    if (access(args[0], X_OK) < 0) {
+        perror(args[0]);
+        exit(1);
+    }
+
+    struct stat st;
+    long keys = stat(argv[optind + 1], &st) == 0 ? st.st_size : 0;
+
+    printf("%s on %s, %ld CPU(s)%s\n", argv[optind], argv[optind + 1], sysconf(_SC_NPROCESSORS_ONLN),
+        pin ? ", instances pinned round-robin" : "");
+    printf("  %9s %10s %14s %8s %7s\n", "instances", "wall ms", "total keys/s", "speedup", "failed");
+
+    double base = 0;
+    int failures = 0;
+    for (int n = 1;; n = n * 2 < max ? n * 2 : max) {
+        double wall;
+        int failed = run(n, args, pin, timeout, &wall);
+        double rate = wall > 0 ? n * keys / wall : 0;
+        if (n == 1) base = rate;
+        printf("  %9d %10.1f %14.1f %7.2fx %7d\n", n, wall * 1e3, rate, base > 0 ? rate / base : 0.0, failed);
+        failures += failed;
+        if (n == max) break;
+    }
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,158 @@
+#ifndef LDISC_H
+#define LDISC_H
+
+// Canonical-mode line discipline: keys are edited into a line and the
+// line is delivered whole on Enter, as a tty in cooked mode does.
+//
+//     ^H, DEL   erase the key before the cursor
+//     ^W        erase the word before the cursor (spaces, then non-spaces)
+//     ^U        kill the whole line
+//     ^A ^E     cursor to start / end of line
+//     ^B ^F     cursor back / forward one key
+//     \n, \r    deliver the line, with a '\n'
+//
+// The line is a gap buffer: the text before the cursor sits at the start
+// of the buffer, the text after it at the end, and the gap in between is
+// where keys go in. Typing and erasing at the cursor are O(1), a kill just
+// widens the gap, and moving the cursor costs only the distance moved. The
+// buffer doubles when the gap closes, so a line of any length costs O(1)
+// amortized per key. A delivered line is handed out in place, one
+// contiguous piece, and is valid until the next key.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LD_MIN_CAP 256
+
+#define LD_CTRL(c) ((c) & 0x1f)
+
+// a finished line, ending in '\n'
+typedef void (*ld_deliver_cb)(const char* line, size_t len, void* arg);
+
+struct ldisc {
+    char* buf;
+    size_t cap;
+    size_t gap;         // cursor: text before it is buf[0, gap)
+    size_t gap_end;     // text after it is buf[gap_end, cap)
+
+    // counters
+    unsigned long lines;
+    unsigned long erased;
+    size_t longest;
+};
+
+static inline void ld_init(struct ldisc* l) {
+    memset(l, 0, sizeof(*l));
+}
+
+static inline size_t ld_len(const struct ldisc* l) {
+    return l->gap + l->cap - l->gap_end;
+}
+
+// room for n more keys at the cursor
+static inline void ld_reserve(struct ldisc* l, size_t n) {
+    if (l->gap_end - l->gap >= n) return;
+    size_t tail = l->cap - l->gap_end;
+    size_t cap = l->cap ? l->cap : LD_MIN_CAP;
+    while (cap - ld_len(l) < n) cap *= 2;
+    char* buf = realloc(l->buf, cap);
+    if (!buf) {
+        perror("line discipline: out of memory");
+        exit(1);
+    }
+    memmove(buf + cap - tail, buf + l->gap_end, tail);
+    l->buf = buf;
+    l->gap_end = cap - tail;
+    l->cap = cap;
+}
+
+static inline void ld_insert(struct ldisc* l, const char* p, size_t n) {
+    ld_reserve(l, n);
+    memcpy(l->buf + l->gap, p, n);
+    l->gap += n;
+}
+
+// moves the cursor to pos, carrying text across the gap
+static inline void ld_move(struct ldisc* l, size_t pos) {
+    if (pos > ld_len(l)) pos = ld_len(l);
+    if (pos < l->gap) {
+        size_t n = l->gap - pos;
+        memmove(l->buf + l->gap_end - n, l->buf + pos, n);
+        l->gap -= n;
+        l->gap_end -= n;
+    }
+    else if (pos > l->gap) {
+        size_t n = pos - l->gap;
+        memmove(l->buf + l->gap, l->buf + l->gap_end, n);
+        l->gap += n;
+        l->gap_end += n;
+    }
+}
+
+static inline void ld_erase(struct ldisc* l, size_t n) {
+    if (n > l->gap) n = l->gap;
+    l->gap -= n;
+    l->erased += n;
+}
+
+static inline void ld_deliver(struct ldisc* l, ld_deliver_cb cb, void* arg) {
+    ld_move(l, ld_len(l));
+    ld_insert(l, "\n", 1);
+    if (l->gap > l->longest) l->longest = l->gap;
+    l->lines++;
+    cb(l->buf, l->gap, arg);
+    l->gap = 0;
+    l->gap_end = l->cap;
+}
+
+// one key
+static inline void ld_key(struct ldisc* l, char ch, ld_deliver_cb cb, void* arg) {
+    switch (ch) {
+    case '\n':
+    case '\r':
+        ld_deliver(l, cb, arg);
+        break;
+    case LD_CTRL('H'):
+    case 0x7f:
+        ld_erase(l, 1);
+        break;
+    case LD_CTRL('W'): {
+        size_t n = l->gap;
+        while (n && l->buf[n - 1] == ' ') n--;
+        while (n && l->buf[n - 1] != ' ') n--;
+        ld_erase(l, l->gap - n);
+        break;
+    }
+    case LD_CTRL('U'):
+        l->erased += ld_len(l);
+        l->gap = 0;
+        l->gap_end = l->cap;
+        break;
+    case LD_CTRL('A'): ld_move(l, 0); break;
+    case LD_CTRL('E'): ld_move(l, ld_len(l)); break;
+    case LD_CTRL('B'): if (l->gap) ld_move(l, l->gap - 1); break;
+    case LD_CTRL('F'): ld_move(l, l->gap + 1); break;
+    default:
+        ld_reserve(l, 1);
+        l->buf[l->gap++] = ch;
+    }
+}
+
+// end of input: what has been typed goes out, like ^D on a tty
+static inline void ld_flush(struct ldisc* l, ld_deliver_cb cb, void* arg) {
+    if (!ld_len(l)) return;
+    ld_move(l, ld_len(l));
+    if (l->gap > l->longest) l->longest = l->gap;
+    l->lines++;
+    cb(l->buf, l->gap, arg);
+    l->gap = 0;
+    l->gap_end = l->cap;
+}
+
+static inline void ld_print_stats(const struct ldisc* l) {
+    fprintf(stderr, "\nline discipline: %lu lines, longest %zu bytes, %lu keys erased, buffer %zu bytes\n",
+        l->lines, l->longest, l->erased, l->cap);
+}
+
+#endif
@@ -0,0 +1,195 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "ldisc.h"
+
+// Line discipline benchmark (ldisc.h) on single lines of -m MB.
+//
+// Each scenario is one long line of keys ending in Enter: plain typing,
+// typing with backspaces and word erases, typing the second half at the
+// start of the line, typing after a walk back into the middle, and typing
+// the line twice with a kill in between. A second run times every key on
+// its own, so besides ns/key the worst single key shows, which is where the
+// buffer doubles. Memory is the gap buffer's size against the line's, and the
+// process's peak RSS. The delivered line is checked against what the
+// scenario should produce.
+
+#define WALKS 1000
+
+double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+uint32_t rng = 1;
+
+uint32_t next_rand() {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+char random_key() {
+    return next_rand() % 6 ? 'a' + next_rand() % 26 : ' ';
+}
+
+struct line {
+    const char* want;
+    size_t want_len;
+    size_t len;
+    int ok;
+};
+
+void deliver(const char* line, size_t len, void* arg) {
+    struct line* got = arg;
+    got->len = len;
+    got->ok = len == got->want_len && !memcmp(line, got->want, len);
+}
+
+// keys and the line they should deliver
+struct scenario {
+    const char* name;
+    char* keys;
+    size_t n;
+    char* want;
+    size_t want_len;
+};
+
+void add_key(struct scenario* s, char ch) {
+    s->keys[s->n++] = ch;
+}
+
+struct scenario make_append(size_t size) {
+    struct scenario s = { "append", malloc(size + 1), 0, malloc(size + 1), 0 };
+    for (size_t i = 0; i < size; i++) add_key(&s, s.want[s.want_len++] = random_key());
+    add_key(&s, '\n');
+    s.want[s.want_len++] = '\n';
+    return s;
+}
+
+struct scenario make_erase(size_t size) {
+    struct scenario s = { "erase", malloc(2 * size + 2), 0, malloc(size + 1), 0 };
+    for (size_t i = 0; i < size; i++) {
+        char ch = random_key();
+        add_key(&s, ch);
+        s.want[s.want_len++] = ch;
+        if (i % 8 == 7) {
+            add_key(&s, LD_CTRL('H'));
+            s.want_len--;
+        }
+        if (i % 64 == 63) {
+            add_key(&s, LD_CTRL('W'));
+            while (s.want_len && s.want[s.want_len - 1] == ' ') s.want_len--;
+            while (s.want_len && s.want[s.want_len - 1] != ' ') s.want_len--;
+        }
+    }
+    add_key(&s, '\n');
+    s.want[s.want_len++] = '\n';
+    return s;
+}
+
+struct scenario make_front(size_t size) {
+    struct scenario s = { "front", malloc(size + 2), 0, malloc(size + 1), 0 };
+    size_t half = size / 2;
+    char* first = malloc(half);
+    for (size_t i = 0; i < half; i++) add_key(&s, first[i] = random_key());
+    add_key(&s, LD_CTRL('A'));
+    for (size_t i = half; i < size; i++) add_key(&s, s.want[s.want_len++] = random_key());
+    memcpy(s.want + s.want_len, first, half);
+    s.want_len += half;
+    add_key(&s, '\n');
+    s.want[s.want_len++] = '\n';
+    free(first);
+    return s;
+}
+
+// type half the line, walk back WALKS keys, type the rest there
+struct scenario make_walk(size_t size) {
+    struct scenario s = { "walk", malloc(size + WALKS + 1), 0, malloc(size + 1), 0 };
+    size_t half = size / 2, back = half < WALKS ? half : WALKS;
+    for (size_t i = 0; i < half; i++) add_key(&s, s.want[s.want_len++] = random_key());
+    for (size_t i = 0; i < back; i++) add_key(&s, LD_CTRL('B'));
+    char* tail = malloc(back);
+    memcpy(tail, s.want + half - back, back);
+    s.want_len -= back;
+    for (size_t i = half; i < size; i++) add_key(&s, s.want[s.want_len++] = random_key());
+    memcpy(s.want + s.want_len, tail, back);
+    s.want_len += back;
+    add_key(&s, '\n');
+    s.want[s.want_len++] = '\n';
+    free(tail);
+    return s;
+}
+
+struct scenario make_kill(size_t size) {
+    struct scenario s = { "kill", malloc(2 * size + 2), 0, malloc(size + 1), 0 };
+    for (size_t i = 0; i < size; i++) add_key(&s, random_key());
+    add_key(&s, LD_CTRL('U'));
+    for (size_t i = 0; i < size; i++) add_key(&s, s.want[s.want_len++] = random_key());
+    add_key(&s, '\n');
+    s.want[s.want_len++] = '\n';
+    return s;
+}
+
+int run(struct scenario* s) {
+    struct ldisc l;
+    struct line got = { s->want, s->want_len, 0, 0 };
+    double worst = 0;
+
+    // once straight through for ns/key, once timing every key for the worst
+    ld_init(&l);
+    double start = now_sec();
+    for (size_t i = 0; i < s->n; i++) ld_key(&l, s->keys[i], deliver, &got);
+    double secs = now_sec() - start;
+    free(l.buf);
+
+    ld_init(&l);
+    for (size_t i = 0; i < s->n; i++) {
+        double t = now_sec();
+        ld_key(&l, s->keys[i], deliver, &got);
+        t = now_sec() - t;
+        if (t > worst) worst = t;
+    }
+
+    printf("  %-8s %9zu %10zu %10zu %8.1f %10.1f  %s\n", s->name, s->n, got.len, l.cap,
+        secs * 1e9 / s->n, worst * 1e6, got.ok ? "ok" : "WRONG LINE");
+    free(l.buf);
+    free(s->keys);
+    free(s->want);
+    return got.ok;
+}
+
+int main(int argc, char* argv[]) {
+    size_t size = 1 << 20;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:")) != -1) {
+        switch (opt) {
+        case 'm': size = (size_t)(atof(optarg) * (1 << 20)); break;
+        default:
+            fprintf(stderr, "Usage: %s [-m line_mb]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    printf("single lines of %zu KB\n", size >> 10);
+    printf("  %-8s %9s %10s %10s %8s %10s\n", "scenario", "keys", "line", "buffer", "ns/key", "worst us");
+    struct scenario (*make[])(size_t) = { make_append, make_erase, make_front, make_walk, make_kill };
+    int ok = 1;
+    for (int i = 0; i < 5; i++) {
+        struct scenario s = make[i](size);
+        ok &= run(&s);
+    }
+
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    printf("  peak RSS %.1f MB\n", ru.ru_maxrss / 1024.0);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
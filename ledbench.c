@@ -0,0 +1,124 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// LED publication benchmark: usb_kbd_event's old leds_lock store against
+// the release store that replaced it.
+//
+// N writer threads each publish LED updates into one shared byte, the way
+// usb_kbd_event does (kbd2.c runs one event thread per LED change, so
+// several can be in flight), while a listener thread keeps loading it as
+// control_listener does. Prints LED updates/sec for each method, and how
+// many loads the listener got through alongside.
+
+#define LED_ON  1
+#define LED_OFF 0
+
+unsigned char leds;
+pthread_mutex_t leds_lock = PTHREAD_MUTEX_INITIALIZER;
+
+long iterations;
+volatile int go;
+volatile int stop;
+long listener_loads;
+
+struct method {
+    const char* name;
+    void* (*writer)(void*);
+    void* (*listener)(void*);
+};
+
+void wait_go() {
+    while (!go) sched_yield();
+}
+
+void* writer_mutex(void* arg) {
+    long id = (long)arg;
+    wait_go();
+    for (long i = 0; i < iterations; i++) {
+        pthread_mutex_lock(&leds_lock);
+        leds = (i + id) & 1 ? LED_ON : LED_OFF;
+        pthread_mutex_unlock(&leds_lock);
+    }
+    return NULL;
+}
+
+// the old listener read the byte without the lock
+void* listener_mutex(void* arg) {
+    long loads = 0;
+    wait_go();
+    while (!stop) {
+        (void)*(volatile unsigned char*)&leds;
+        loads++;
+    }
+    listener_loads = loads;
+    return NULL;
+}
+
+void* writer_atomic(void* arg) {
+    long id = (long)arg;
+    wait_go();
+    for (long i = 0; i < iterations; i++)
+        __atomic_store_n(&leds, (i + id) & 1 ? LED_ON : LED_OFF, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+void* listener_atomic(void* arg) {
+    long loads = 0;
+    wait_go();
+    while (!stop) {
+        (void)__atomic_load_n(&leds, __ATOMIC_ACQUIRE);
+        loads++;
+    }
+    listener_loads = loads;
+    return NULL;
+}
+
+double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double run(struct method* m, int writers) {
+    pthread_t threads[64], listener;
+    go = 0;
+    stop = 0;
+    for (long i = 0; i < writers; i++) pthread_create(&threads[i], NULL, m->writer, (void*)i);
+    pthread_create(&listener, NULL, m->listener, NULL);
+
+    double start = now_sec();
+    go = 1;
+    for (int i = 0; i < writers; i++) pthread_join(threads[i], NULL);
+    double secs = now_sec() - start;
+    stop = 1;
+    pthread_join(listener, NULL);
+    return secs;
+}
+
+int main(int argc, char* argv[]) {
+    int writers = argc > 1 ? atoi(argv[1]) : 4;
+    iterations = argc > 2 ? atol(argv[2]) : 5000000;
+    if (writers < 1 || writers > 64) {
+        fprintf(stderr, "Usage: %s [writers (1-64)] [updates per writer]\n", argv[0]);
+        exit(1);
+    }
+
+    struct method methods[] = {
+        { "mutex (leds_lock)", writer_mutex, listener_mutex },
+        { "release/acquire", writer_atomic, listener_atomic },
+    };
+
+    printf("%d writer(s) + 1 listener on %ld CPU(s), %ld updates per writer\n", writers,
+        sysconf(_SC_NPROCESSORS_ONLN), iterations);
+    for (int i = 0; i < 2; i++) {
+        double secs = run(&methods[i], writers);
+        printf("  %-20s %8.3fs  %8.2f M updates/sec  %8.2f M listener loads/sec\n", methods[i].name, secs,
+            writers * iterations / secs / 1e6, listener_loads / secs / 1e6);
+    }
+    return 0;
+}
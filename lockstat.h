@@ -0,0 +1,274 @@
+#ifndef LOCKSTAT_H
+#define LOCKSTAT_H
+
+// Opt-in lock and endpoint instrumentation for the keyboard driver.
+//
+// Build with -DKBD_LOCKSTAT to record, for every wrapped mutex and blocking
+// endpoint read, how often it was taken, how often it had to wait, and how
+// long it was held or waited on. A live wait-for graph (which thread waits on
+// what, and who holds it) is dumped to stderr when the driver process gets
+// SIGUSR2, when a thread has been blocked longer than LOCKSTAT_HANG_MS, and
+// when the driver exits. Without the flag the macros are
+// the plain pthread/read calls, so a normal build pays nothing.
+
+#include <pthread.h>
+#include <unistd.h>
+
+#ifndef KBD_LOCKSTAT
+
+struct lockstat { int unused; };
+
+#define LOCKSTAT(var, name, peer) struct lockstat var
+#define lockstat_init()
+#define lockstat_dump(why)
+#define lockstat_thread(name)
+#define lockstat_lock(st, m) pthread_mutex_lock(m)
+#define lockstat_unlock(st, m) pthread_mutex_unlock(m)
+#define lockstat_read(st, fd, buf, n) read(fd, buf, n)
+
+#else
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define LOCKSTAT_MAX_RES     32
+#define LOCKSTAT_MAX_THREADS 256
+#ifndef LOCKSTAT_HANG_MS
+#define LOCKSTAT_HANG_MS     2000
+#endif
+
+// a mutex or a blocking endpoint. peer names whoever must write to the
+// endpoint before a read can return; it is NULL for mutexes
+struct lockstat {
+    const char* name;
+    const char* peer;
+    int id;
+
+    unsigned long acquires;
+    unsigned long contended;
+    uint64_t wait_ns, max_wait_ns;
+    uint64_t hold_ns, max_hold_ns;
+
+    int holder;             // thread slot, -1 when free
+    uint64_t held_since;
+};
+
+struct lockstat_thread {
+    const char* name;
+    unsigned long seq;
+    int in_use;
+    int waiting_on;         // resource id, -1 when running
+    uint64_t wait_since;
+    uint32_t held;          // bitmask of resource ids
+};
+
+#define LOCKSTAT(var, name, peer) struct lockstat var = { name, peer, -1, 0, 0, 0, 0, 0, 0, -1, 0 }
+
+static pthread_mutex_t ls_registry = PTHREAD_MUTEX_INITIALIZER;
+static struct lockstat* ls_res[LOCKSTAT_MAX_RES];
+static int ls_nres;
+static uint32_t ls_order[LOCKSTAT_MAX_RES];   // ls_order[a] has b: b taken while a held
+static struct lockstat_thread ls_threads[LOCKSTAT_MAX_THREADS];
+static unsigned long ls_seq;
+static pthread_key_t ls_key;
+static __thread int ls_slot = -1;
+static volatile sig_atomic_t ls_dump_requested;
+
+static uint64_t ls_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void ls_release_slot(void* arg) {
+    pthread_mutex_lock(&ls_registry);
+    ls_threads[(intptr_t)arg - 1].in_use = 0;
+    pthread_mutex_unlock(&ls_registry);
+}
+
+// called with ls_registry held
+static int ls_self(void) {
+    if (ls_slot >= 0) return ls_slot;
+    for (int i = 0; i < LOCKSTAT_MAX_THREADS; i++) {
+        if (ls_threads[i].in_use) continue;
+        ls_threads[i] = (struct lockstat_thread){ "thread", ++ls_seq, 1, -1, 0, 0 };
+        ls_slot = i;
+        pthread_setspecific(ls_key, (void*)(intptr_t)(i + 1));
+        return i;
+    }
+    return LOCKSTAT_MAX_THREADS - 1;
+}
+
+static void ls_register(struct lockstat* st) {
+    if (st->id >= 0 || ls_nres == LOCKSTAT_MAX_RES) return;
+    st->id = ls_nres;
+    ls_res[ls_nres++] = st;
+}
+
+static void lockstat_thread(const char* name) {
+    pthread_mutex_lock(&ls_registry);
+    ls_threads[ls_self()].name = name;
+    pthread_mutex_unlock(&ls_registry);
+}
+
+static void ls_begin_wait(struct lockstat* st, uint64_t now) {
+    pthread_mutex_lock(&ls_registry);
+    ls_register(st);
+    struct lockstat_thread* t = &ls_threads[ls_self()];
+    t->waiting_on = st->id;
+    t->wait_since = now;
+    pthread_mutex_unlock(&ls_registry);
+}
+
+static void ls_end_wait(struct lockstat* st, uint64_t start, int blocked) {
+    uint64_t now = ls_now(), waited = now - start;
+
+    pthread_mutex_lock(&ls_registry);
+    ls_register(st);
+    int self = ls_self();
+    struct lockstat_thread* t = &ls_threads[self];
+    t->waiting_on = -1;
+
+    st->acquires++;
+    st->contended += blocked;
+    st->wait_ns += waited;
+    if (waited > st->max_wait_ns) st->max_wait_ns = waited;
+
+    if (!st->peer) {
+        // record lock order and flag inversions the first time they appear
+        for (uint32_t h = t->held; h; h &= h - 1) {
+            int a = __builtin_ctz(h);
+            if (!(ls_order[a] & (1u << st->id)) && (ls_order[st->id] & (1u << a)))
+                fprintf(stderr, "lockstat: lock order inversion %s -> %s (%s#%lu)\n",
+                    ls_res[a]->name, st->name, t->name, t->seq);
+            ls_order[a] |= 1u << st->id;
+        }
+        t->held |= 1u << st->id;
+        st->holder = self;
+        st->held_since = now;
+    }
+    pthread_mutex_unlock(&ls_registry);
+}
+
+static inline int lockstat_lock(struct lockstat* st, pthread_mutex_t* m) {
+    uint64_t start = ls_now();
+    int blocked = 0;
+
+    int ret = pthread_mutex_trylock(m);
+    if (ret == EBUSY) {
+        blocked = 1;
+        ls_begin_wait(st, start);
+        ret = pthread_mutex_lock(m);
+    }
+    if (ret == 0) ls_end_wait(st, start, blocked);
+    return ret;
+}
+
+static inline int lockstat_unlock(struct lockstat* st, pthread_mutex_t* m) {
+    uint64_t held = ls_now() - st->held_since;
+
+    pthread_mutex_lock(&ls_registry);
+    st->hold_ns += held;
+    if (held > st->max_hold_ns) st->max_hold_ns = held;
+    st->holder = -1;
+    if (ls_slot >= 0 && st->id >= 0) ls_threads[ls_slot].held &= ~(1u << st->id);
+    pthread_mutex_unlock(&ls_registry);
+
+    return pthread_mutex_unlock(m);
+}
+
+static ssize_t lockstat_read(struct lockstat* st, int fd, void* buf, size_t n) {
+    uint64_t start = ls_now();
+    ls_begin_wait(st, start);
+    ssize_t ret = read(fd, buf, n);
+    // anything over 1ms counts as having waited on the peer
+    ls_end_wait(st, start, ls_now() - start > 1000000);
+    return ret;
+}
+
+static void lockstat_dump(const char* why) {
+    uint64_t now = ls_now();
+
+    pthread_mutex_lock(&ls_registry);
+    fprintf(stderr, "\nlockstat: %s\n", why);
+    for (int i = 0; i < ls_nres; i++) {
+        struct lockstat* st = ls_res[i];
+        fprintf(stderr, "  %-14s %8lu %s, %lu waited, wait avg %lu/max %lu us",
+            st->name, st->acquires, st->peer ? "reads" : "locks", st->contended,
+            st->acquires ? (unsigned long)(st->wait_ns / st->acquires / 1000) : 0,
+            (unsigned long)(st->max_wait_ns / 1000));
+        if (!st->peer)
+            fprintf(stderr, ", hold avg %lu/max %lu us",
+                st->acquires ? (unsigned long)(st->hold_ns / st->acquires / 1000) : 0,
+                (unsigned long)(st->max_hold_ns / 1000));
+        fprintf(stderr, "\n");
+    }
+
+    fprintf(stderr, "  wait-for graph:\n");
+    int idle = 1;
+    for (int i = 0; i < LOCKSTAT_MAX_THREADS; i++) {
+        struct lockstat_thread* t = &ls_threads[i];
+        if (!t->in_use || t->waiting_on < 0) continue;
+        struct lockstat* st = ls_res[t->waiting_on];
+        idle = 0;
+
+        fprintf(stderr, "    %s#%lu -> %s", t->name, t->seq, st->name);
+        if (st->peer) fprintf(stderr, " -> %s", st->peer);
+        else if (st->holder >= 0)
+            fprintf(stderr, " -> %s#%lu", ls_threads[st->holder].name, ls_threads[st->holder].seq);
+        fprintf(stderr, " (%lu ms)\n", (unsigned long)((now - t->wait_since) / 1000000));
+    }
+    if (idle) fprintf(stderr, "    (no thread waiting)\n");
+    pthread_mutex_unlock(&ls_registry);
+}
+
+static void ls_sigusr2(int sig) {
+    (void)sig;
+    ls_dump_requested = 1;
+}
+
+// dumps on request, and once per stall when some thread stops moving
+static void* ls_watchdog(void* arg) {
+    (void)arg;
+    unsigned long reported = 0;
+
+    lockstat_thread("lockstat");
+    while (1) {
+        usleep(100000);
+        if (ls_dump_requested) {
+            ls_dump_requested = 0;
+            lockstat_dump("SIGUSR2");
+        }
+
+        uint64_t now = ls_now();
+        unsigned long stalled = 0;
+        pthread_mutex_lock(&ls_registry);
+        for (int i = 0; i < LOCKSTAT_MAX_THREADS; i++) {
+            struct lockstat_thread* t = &ls_threads[i];
+            if (t->in_use && t->waiting_on >= 0 && now - t->wait_since > LOCKSTAT_HANG_MS * 1000000ull)
+                stalled = t->seq;
+        }
+        pthread_mutex_unlock(&ls_registry);
+
+        if (stalled && stalled != reported) lockstat_dump("possible hang");
+        reported = stalled;
+    }
+    return NULL;
+}
+
+static void lockstat_init(void) {
+    pthread_key_create(&ls_key, ls_release_slot);
+    signal(SIGUSR2, ls_sigusr2);
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, ls_watchdog, NULL);
+    pthread_detach(tid);
+}
+
+#endif
+
+#endif
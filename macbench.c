@@ -0,0 +1,142 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+
+#include "macro.h"
+#include "outq.h"
+
+// Macro expansion benchmark (macro.h, outq.h).
+//
+// Defines -n macros (a million by default), ';' plus 5-8 letters each with
+// 10-80 bytes of text, and compares loading them from the text config
+// (parse, sort, build) with mapping a saved image. Then types -k M keys of
+// plain text with a trigger every 20 keys or so through the engine into
+// the batched writer on /dev/null. Every trigger typed must expand exactly
+// once.
+
+#define CORPUS_TXT "macro_corpus.tmp"
+#define CORPUS_IMG "macro_image.tmp"
+
+double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+uint32_t rng = 1;
+
+uint32_t next_rand() {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+struct outq out;
+
+void put(char ch, void* arg) {
+    outq_char(&out, ch);
+}
+
+void ref(const char* p, size_t len, void* arg) {
+    outq_ref(&out, p, len);
+}
+
+int main(int argc, char* argv[]) {
+    long count = 1000000;
+    size_t keys = 16 << 20;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:k:")) != -1) {
+        switch (opt) {
+        case 'n': count = atol(optarg); break;
+        case 'k': keys = (size_t)atol(optarg) << 20; break;
+        default:
+            fprintf(stderr, "Usage: %s [-n macros] [-k stream_mkeys]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (count < 1) count = 1;
+
+    // the config, as text
+    FILE* f = fopen(CORPUS_TXT, "w");
+    if (!f) {
+        perror("unable to create corpus");
+        exit(1);
+    }
+    char** triggers = malloc(count * sizeof(char*));
+    for (long i = 0; i < count; i++) {
+        int tlen = 6 + next_rand() % 4, len = 10 + next_rand() % 71;
+        triggers[i] = malloc(tlen + 1);
+        triggers[i][0] = ';';
+        for (int j = 1; j < tlen; j++) triggers[i][j] = 'a' + next_rand() % 26;
+        triggers[i][tlen] = 0;
+        fprintf(f, "%s\t", triggers[i]);
+        for (int j = 0; j < len; j++) fputc('a' + next_rand() % 26, f);
+        fputs("\\n\n", f);
+    }
+    fclose(f);
+
+    struct macros m;
+    double start = now_sec();
+    if (mac_load(&m, CORPUS_TXT) < 0) {
+        perror("unable to load corpus");
+        exit(1);
+    }
+    double built = now_sec() - start;
+    if (mac_save(&m, CORPUS_IMG) < 0) {
+        perror("unable to save image");
+        exit(1);
+    }
+
+    mac_free(&m);
+
+    start = now_sec();
+    if (mac_load(&m, CORPUS_IMG) < 0) {
+        perror("unable to map image");
+        exit(1);
+    }
+    double mapped = now_sec() - start;
+
+    printf("%u macros, %u trie nodes, image %.1f MB (arena %.1f MB)\n", m.hdr->macros, m.hdr->nodes,
+        m.image_size / 1048576.0, m.hdr->arena / 1048576.0);
+    printf("  load from text  %9.1f ms\n", built * 1e3);
+    printf("  map saved image %9.3f ms\n", mapped * 1e3);
+
+    // typing: letters and spaces, and now and then a trigger
+    char* text = malloc(keys);
+    unsigned long typed = 0;
+    for (size_t i = 0; i < keys;) {
+        if (next_rand() % 20 == 0) {
+            const char* t = triggers[next_rand() % count];
+            size_t l = strlen(t);
+            if (i + l > keys) break;
+            memcpy(text + i, t, l);
+            i += l;
+            typed++;
+        }
+        else text[i++] = next_rand() % 6 ? 'a' + next_rand() % 26 : ' ';
+    }
+
+    outq_init(&out, open("/dev/null", O_WRONLY));
+    start = now_sec();
+    for (size_t i = 0; i < keys; i++) mac_feed(&m, text[i], put, ref, NULL);
+    mac_flush(&m, put, NULL);
+    outq_flush(&out);
+    double secs = now_sec() - start;
+
+    printf("  %zu M keys in %.3fs = %.1f ns/key, %lu expansions, %.1f MB out in %lu writevs\n", keys >> 20,
+        secs, secs * 1e9 / keys, m.expanded, out.bytes / 1048576.0, out.writes);
+
+    unlink(CORPUS_TXT);
+    unlink(CORPUS_IMG);
+    if (m.expanded != typed) {
+        printf("  MISMATCH: %lu triggers typed, %lu expanded\n", typed, m.expanded);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
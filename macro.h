@@ -0,0 +1,374 @@
+#ifndef MACRO_H
+#define MACRO_H
+
+// Macro expansion: typed trigger sequences are replaced by stored text.
+//
+// Everything lives in one image, laid out the same in memory and on disk:
+//
+//     header   magic, counts
+//     nodes    trie index: per node its first edge, edge count and macro
+//     child    per edge, the node it leads to
+//     exps     per macro, offset and length of its text in the arena
+//     keys     per edge, the key; a node's edges are contiguous and sorted
+//     arena    every expansion, back to back
+//
+// Nodes are 12 bytes and an edge 5, so a million triggers fit in a few
+// tens of MB, and finding the edge for a key is one memchr over that
+// node's keys. An image built from the text config can be saved and later
+// mapped straight back in (mac_load picks by the magic). Loading then costs
+// an mmap and one pass checking that every index stays inside the image,
+// no parsing or building. Expansions go out by reference into the arena,
+// never copied.
+//
+// Typing: keys that could still be part of a trigger are held back. When
+// a trigger completes, the held keys are dropped and its expansion goes
+// out instead. When no trigger can go on, the oldest held key goes out as
+// typed and the rest are tried again. The shortest trigger wins, so a
+// trigger that is a prefix of another shadows it.
+//
+// Config: one macro per line, trigger, a tab, then the expansion, in which
+// \n, \t and \\ are escapes. Lines starting with '#' are skipped.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAC_MAGIC       "KBDMAC01"
+#define MAC_MAX_TRIGGER 64
+#define MAC_NONE        0xffffffffu
+
+struct mac_header {
+    char magic[8];
+    uint32_t nodes;
+    uint32_t edges;
+    uint32_t macros;
+    uint32_t reserved;
+    uint64_t arena;
+};
+
+struct mac_node {
+    uint32_t edges;     // first edge
+    uint32_t macro;     // MAC_NONE unless a trigger ends here
+    uint16_t nedges;
+    uint16_t reserved;
+};
+
+struct mac_exp {
+    uint32_t off;
+    uint32_t len;
+};
+
+// a key typed as is, and expansion text by reference
+typedef void (*mac_char_cb)(char ch, void* arg);
+typedef void (*mac_ref_cb)(const char* p, size_t len, void* arg);
+
+struct macros {
+    const struct mac_header* hdr;
+    const struct mac_node* node;
+    const uint32_t* child;
+    const struct mac_exp* exp;
+    const uint8_t* key;
+    const char* arena;
+
+    void* image;
+    size_t image_size;
+    int mapped;
+
+    // typing state
+    uint32_t at;                        // trie node of the held keys
+    char held[MAC_MAX_TRIGGER];
+    int nheld;
+
+    // counters
+    unsigned long expanded;
+};
+
+static inline size_t mac_image_size(uint32_t nodes, uint32_t edges, uint32_t macros, uint64_t arena) {
+    return sizeof(struct mac_header) + nodes * sizeof(struct mac_node) + edges * sizeof(uint32_t)
+        + macros * sizeof(struct mac_exp) + edges + arena;
+}
+
+// points the index at an image; -1 if it is not one, is cut short, or
+// has an edge, child, macro or text that points outside it
+static inline int mac_attach(struct macros* m, void* image, size_t size) {
+    const struct mac_header* h = image;
+    if (size < sizeof(*h) || memcmp(h->magic, MAC_MAGIC, 8) || h->arena > size
+        || size < mac_image_size(h->nodes, h->edges, h->macros, h->arena) || !h->nodes)
+        return -1;
+    m->hdr = h;
+    m->node = (const struct mac_node*)(h + 1);
+    m->child = (const uint32_t*)(m->node + h->nodes);
+    m->exp = (const struct mac_exp*)(m->child + h->edges);
+    m->key = (const uint8_t*)(m->exp + h->macros);
+    m->arena = (const char*)(m->key + h->edges);
+    for (uint32_t i = 0; i < h->nodes; i++) {
+        if ((uint64_t)m->node[i].edges + m->node[i].nedges > h->edges) return -1;
+        if (m->node[i].macro != MAC_NONE && m->node[i].macro >= h->macros) return -1;
+    }
+    for (uint32_t i = 0; i < h->edges; i++)
+        if (m->child[i] >= h->nodes) return -1;
+    for (uint32_t i = 0; i < h->macros; i++)
+        if ((uint64_t)m->exp[i].off + m->exp[i].len > h->arena) return -1;
+    m->image = image;
+    m->image_size = size;
+    m->at = 0;
+    m->nheld = 0;
+    m->expanded = 0;
+    return 0;
+}
+
+// Building. Triggers are sorted, then the trie comes out of one recursive
+// pass over them: at each depth the triggers under a node form contiguous
+// runs, one per next key, so a node's edges can be reserved together.
+struct mac_def {
+    const char* trigger;
+    size_t tlen;
+    const char* text;
+    size_t len;
+};
+
+struct mac_builder {
+    const struct mac_def* defs;
+    const uint32_t* order;
+    struct mac_node* node;
+    uint32_t* child;
+    struct mac_exp* exp;
+    uint8_t* key;
+    char* arena;
+    uint32_t nodes, edges, macros;
+    uint64_t arena_used;
+};
+
+static inline int mac_cmp_defs(const void* a, const void* b, void* defs) {
+    const struct mac_def* x = &((const struct mac_def*)defs)[*(const uint32_t*)a];
+    const struct mac_def* y = &((const struct mac_def*)defs)[*(const uint32_t*)b];
+    size_t n = x->tlen < y->tlen ? x->tlen : y->tlen;
+    int c = memcmp(x->trigger, y->trigger, n);
+    if (c) return c;
+    // equal triggers keep their order, so the first definition wins
+    if (x->tlen != y->tlen) return x->tlen < y->tlen ? -1 : 1;
+    return *(const uint32_t*)a < *(const uint32_t*)b ? -1 : 1;
+}
+
+static inline uint32_t mac_build_node(struct mac_builder* b, uint32_t lo, uint32_t hi, size_t depth) {
+    uint32_t id = b->nodes++;
+    struct mac_node* n = &b->node[id];
+    n->macro = MAC_NONE;
+    n->reserved = 0;
+
+    // triggers that end here sort first; the first of them is the macro
+    if (lo < hi && b->defs[b->order[lo]].tlen == depth) {
+        const struct mac_def* d = &b->defs[b->order[lo]];
+        n->macro = b->macros++;
+        b->exp[n->macro] = (struct mac_exp){ (uint32_t)b->arena_used, (uint32_t)d->len };
+        memcpy(b->arena + b->arena_used, d->text, d->len);
+        b->arena_used += d->len;
+        while (lo < hi && b->defs[b->order[lo]].tlen == depth) lo++;
+    }
+
+    uint16_t runs = 0;
+    for (uint32_t i = lo; i < hi; i++)
+        if (i == lo || b->defs[b->order[i]].trigger[depth] != b->defs[b->order[i - 1]].trigger[depth]) runs++;
+    n->edges = b->edges;
+    n->nedges = runs;
+    b->edges += runs;
+
+    uint32_t e = n->edges;
+    for (uint32_t i = lo; i < hi; e++) {
+        uint8_t k = b->defs[b->order[i]].trigger[depth];
+        uint32_t j = i;
+        while (j < hi && (uint8_t)b->defs[b->order[j]].trigger[depth] == k) j++;
+        b->key[e] = k;
+        uint32_t c = mac_build_node(b, i, j, depth + 1);
+        b->child[e] = c;
+        i = j;
+    }
+    return id;
+}
+
+// builds an image from n definitions; triggers must be 1..MAC_MAX_TRIGGER-1
+// keys long. The image is malloc'd and owned by m.
+static inline void mac_build(struct macros* m, const struct mac_def* defs, uint32_t n) {
+    uint64_t keys = 0, text = 0;
+    uint32_t* order = malloc((n ? n : 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < n; i++) {
+        order[i] = i;
+        keys += defs[i].tlen;
+        text += defs[i].len;
+    }
+    qsort_r(order, n, sizeof(uint32_t), mac_cmp_defs, (void*)defs);
+
+    // sized for the worst case, no shared prefixes, then packed
+    struct mac_builder b = { .defs = defs, .order = order };
+    b.node = malloc((keys + 1) * sizeof(struct mac_node));
+    b.child = malloc((keys + 1) * sizeof(uint32_t));
+    b.exp = malloc((n ? n : 1) * sizeof(struct mac_exp));
+    b.key = malloc(keys + 1);
+    b.arena = malloc(text + 1);
+    if (!order || !b.node || !b.child || !b.exp || !b.key || !b.arena) {
+        perror("macros: out of memory");
+        exit(1);
+    }
+    mac_build_node(&b, 0, n, 0);
+
+    size_t size = mac_image_size(b.nodes, b.edges, b.macros, b.arena_used);
+    char* image = malloc(size);
+    if (!image) {
+        perror("macros: out of memory");
+        exit(1);
+    }
+    struct mac_header* h = (struct mac_header*)image;
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, MAC_MAGIC, 8);
+    h->nodes = b.nodes;
+    h->edges = b.edges;
+    h->macros = b.macros;
+    h->arena = b.arena_used;
+    char* p = image + sizeof(*h);
+    memcpy(p, b.node, b.nodes * sizeof(struct mac_node));
+    p += b.nodes * sizeof(struct mac_node);
+    memcpy(p, b.child, b.edges * sizeof(uint32_t));
+    p += b.edges * sizeof(uint32_t);
+    memcpy(p, b.exp, b.macros * sizeof(struct mac_exp));
+    p += b.macros * sizeof(struct mac_exp);
+    memcpy(p, b.key, b.edges);
+    p += b.edges;
+    memcpy(p, b.arena, b.arena_used);
+
+    free(order);
+    free(b.node);
+    free(b.child);
+    free(b.exp);
+    free(b.key);
+    free(b.arena);
+    mac_attach(m, image, size);
+    m->mapped = 0;
+}
+
+// parses the text config in place (escapes shrink the text) into defs;
+// returns how many
+static inline uint32_t mac_parse(char* text, size_t size, struct mac_def** defs) {
+    uint32_t n = 0, cap = 1024;
+    *defs = malloc(cap * sizeof(struct mac_def));
+    for (char* line = text; line < text + size;) {
+        char* end = memchr(line, '\n', text + size - line);
+        if (!end) end = text + size;
+        char* tab = memchr(line, '\t', end - line);
+        size_t tlen = tab ? (size_t)(tab - line) : 0;
+        if (line[0] != '#' && tab && tlen > 0 && tlen < MAC_MAX_TRIGGER) {
+            char* out = tab + 1;
+            char* start = out;
+            for (char* in = tab + 1; in < end && *in != '\r'; in++) {
+                if (*in == '\\' && in + 1 < end) {
+                    in++;
+                    *out++ = *in == 'n' ? '\n' : *in == 't' ? '\t' : *in;
+                }
+                else *out++ = *in;
+            }
+            if (n == cap) *defs = realloc(*defs, (cap *= 2) * sizeof(struct mac_def));
+            (*defs)[n++] = (struct mac_def){ line, tlen, start, (size_t)(out - start) };
+        }
+        line = end + 1;
+    }
+    return n;
+}
+
+static inline int mac_save(const struct macros* m, const char* path) {
+    FILE* f = fopen(path, "w");
+    if (!f) return -1;
+    size_t n = fwrite(m->image, 1, m->image_size, f);
+    if (fclose(f) || n != m->image_size) return -1;
+    return 0;
+}
+
+// a saved image is mapped as is, a text config is parsed and built; -1 if
+// the file can't be read
+static inline int mac_load(struct macros* m, const char* path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) return -1;
+    size_t size = st.st_size;
+
+    char magic[8] = { 0 };
+    if (pread(fd, magic, 8, 0) == 8 && !memcmp(magic, MAC_MAGIC, 8)) {
+        void* image = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (image == MAP_FAILED || mac_attach(m, image, size) < 0) return -1;
+        m->mapped = 1;
+        return 0;
+    }
+
+    char* text = malloc(size + 1);
+    ssize_t got = read(fd, text, size);
+    close(fd);
+    if (got < 0) return -1;
+    struct mac_def* defs;
+    uint32_t n = mac_parse(text, got, &defs);
+    mac_build(m, defs, n);
+    free(defs);
+    free(text);
+    return 0;
+}
+
+static inline void mac_free(struct macros* m) {
+    if (m->mapped) munmap(m->image, m->image_size);
+    else free(m->image);
+}
+
+static inline uint32_t mac_step(const struct macros* m, uint32_t at, char ch) {
+    const struct mac_node* n = &m->node[at];
+    const uint8_t* k = memchr(m->key + n->edges, (unsigned char)ch, n->nedges);
+    return k ? m->child[k - m->key] : MAC_NONE;
+}
+
+// the held keys go out as typed
+static inline void mac_flush(struct macros* m, mac_char_cb put, void* arg) {
+    for (int i = 0; i < m->nheld; i++) put(m->held[i], arg);
+    m->nheld = 0;
+    m->at = 0;
+}
+
+// one typed key
+static inline void mac_feed(struct macros* m, char ch, mac_char_cb put, mac_ref_cb ref, void* arg) {
+    uint32_t next = m->nheld < MAC_MAX_TRIGGER - 1 ? mac_step(m, m->at, ch) : MAC_NONE;
+    if (next != MAC_NONE) {
+        uint32_t macro = m->node[next].macro;
+        if (macro == MAC_NONE) {
+            m->held[m->nheld++] = ch;
+            m->at = next;
+            return;
+        }
+        ref(m->arena + m->exp[macro].off, m->exp[macro].len, arg);
+        m->expanded++;
+        m->nheld = 0;
+        m->at = 0;
+        return;
+    }
+    if (!m->nheld) {
+        put(ch, arg);
+        return;
+    }
+
+    // no trigger goes on with ch: the oldest held key is plain text, and
+    // the rest may still start one
+    char keys[MAC_MAX_TRIGGER];
+    int n = m->nheld;
+    memcpy(keys, m->held, n);
+    keys[n++] = ch;
+    m->nheld = 0;
+    m->at = 0;
+    put(keys[0], arg);
+    for (int i = 1; i < n; i++) mac_feed(m, keys[i], put, ref, arg);
+}
+
+static inline void mac_print_stats(const struct macros* m) {
+    fprintf(stderr, "\nmacros: %u defined (%s, %zu bytes), %lu expanded\n", m->hdr->macros,
+        m->mapped ? "mapped" : "built", m->image_size, m->expanded);
+}
+
+#endif
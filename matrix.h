@@ -0,0 +1,253 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
+// Simulated keyboard matrix, as a load source for the interrupt endpoint.
+//
+// The switches sit on an 8x8 row/column grid held in one 64-bit bitboard:
+// bit k is row k / 8, column k % 8, and key k is HID usage KEV_USAGE_A + k,
+// which covers a..z, digits, punctuation and capslock, with left shift in
+// the spare bit after them. Every scan
+//
+//     1. reads the grid the way a diode-less matrix is wired: pressing three
+//        corners of a rectangle closes the fourth (ghosting), so each row
+//        reads the OR of every row it shares a column with
+//     2. overlays contact bounce: for a few scans after a switch changes its
+//        bit reads as noise
+//     3. debounces with 2-bit vertical counters, a key changes state after
+//        reading the same for 4 scans in a row
+//     4. refuses new presses while the reading is ambiguous (two rows share
+//        two columns, so some key in that rectangle may be a ghost), as
+//        anti-ghosting firmware does
+//     5. diffs the result against what has been reported and turns each
+//        change into the wire codes the simulator sends (kev_to_char)
+//
+// Steps 1-5 are whole-bitboard operations, with a per-bit loop only over
+// keys that changed, so a scan of an idle or steadily held matrix is a
+// handful of ALU ops. A typist drives the switches from a text in the
+// endpoint's own format.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "kev.h"
+
+#define MX_KEYS        64
+#define MX_KEY_SHIFT   (KEV_USAGE_CAPSLOCK - KEV_USAGE_A + 1)
+#define MX_BOUNCE_MAX  3   // scans a switch may chatter for
+#define MX_MAX_EVENTS  8   // wire codes one scan can produce
+
+struct kbd_matrix {
+    uint64_t physical;      // switches actually closed
+    uint64_t debounced;
+    uint64_t reported;      // what the host has been told
+    uint64_t ct0, ct1;      // vertical debounce counters
+    uint64_t bouncing;
+    uint8_t bounce_left[MX_KEYS];
+    uint32_t rng;
+
+    // counters
+    unsigned long scans;
+    unsigned long events;
+    unsigned long bounces;          // switch changes that chattered
+    unsigned long ghost_scans;      // scans that read an ambiguous grid
+    unsigned long ghost_blocked;    // presses held back by anti-ghosting
+};
+
+static inline void mx_init(struct kbd_matrix* m, uint32_t seed) {
+    memset(m, 0, sizeof(*m));
+    m->ct0 = m->ct1 = ~0ull;
+    m->rng = seed ? seed : 1;
+}
+
+static inline uint32_t mx_rand(struct kbd_matrix* m) {
+    m->rng ^= m->rng << 13;
+    m->rng ^= m->rng >> 17;
+    m->rng ^= m->rng << 5;
+    return m->rng;
+}
+
+// usage to key, -1 if the matrix has no such key
+static inline int mx_key(int usage) {
+    if (usage < KEV_USAGE_A || usage > KEV_USAGE_CAPSLOCK) return -1;
+    return usage - KEV_USAGE_A;
+}
+
+// closes or opens a switch; it chatters for a few scans
+static inline void mx_set(struct kbd_matrix* m, int key, int down) {
+    uint64_t bit = 1ull << key;
+    if (!!(m->physical & bit) == down) return;
+    m->physical ^= bit;
+    m->bounce_left[key] = mx_rand(m) % (MX_BOUNCE_MAX + 1);
+    if (m->bounce_left[key]) {
+        m->bouncing |= bit;
+        m->bounces++;
+    }
+}
+
+// the grid as a diode-less matrix reads it: rows that share a column are
+// connected, and connected rows all read the OR of each other. For each row
+// distance d, lanes whose row shares a column with the row d below take
+// its columns and give it theirs, until nothing changes.
+static inline uint64_t mx_ghost(uint64_t p) {
+    // fewer than three keys can't close a rectangle
+    if (__builtin_popcountll(p) < 3) return p;
+
+    for (uint64_t prev = 0; prev != p;) {
+        prev = p;
+        for (int d = 1; d < 8; d++) {
+            uint64_t x = p & (p >> (8 * d));
+            uint64_t nz = (((x & 0x7f7f7f7f7f7f7f7full) + 0x7f7f7f7f7f7f7f7full) | x) & 0x8080808080808080ull;
+            uint64_t lanes = (nz >> 7) * 0xff;
+            p |= (p >> (8 * d)) & lanes;
+            p |= (p & lanes) << (8 * d);
+        }
+    }
+    return p;
+}
+
+// two rows sharing two columns: some key in that rectangle may be a ghost.
+// Shifting the board by d rows lines row i+d up under row i, so one AND
+// gives the shared columns of every pair d apart; a per-byte popcount of 2
+// or more in any lane is a rectangle.
+static inline int mx_ambiguous(uint64_t raw) {
+    if (__builtin_popcountll(raw) < 4) return 0;
+    for (int d = 1; d < 8; d++) {
+        uint64_t x = raw & (raw >> (8 * d));
+        x = x - ((x >> 1) & 0x5555555555555555ull);
+        x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+        x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+        if ((x + 0x7e7e7e7e7e7e7e7eull) & 0x8080808080808080ull) return 1;
+    }
+    return 0;
+}
+
+// one scan; writes the wire codes for what changed to out, returns how many
+static inline int mx_scan(struct kbd_matrix* m, char* out) {
+    m->scans++;
+    uint64_t raw = mx_ghost(m->physical);
+
+    if (m->bouncing) {
+        raw = (raw & ~m->bouncing) | (((uint64_t)mx_rand(m) << 32 | mx_rand(m)) & m->bouncing);
+        for (uint64_t b = m->bouncing; b; b &= b - 1) {
+            int k = __builtin_ctzll(b);
+            if (!--m->bounce_left[k]) m->bouncing &= ~(1ull << k);
+        }
+    }
+
+    if (mx_ambiguous(raw)) {
+        m->ghost_scans++;
+        m->ghost_blocked += __builtin_popcountll(raw & ~m->debounced);
+        raw &= m->debounced;
+    }
+
+    // vertical counters: a bit flips after 4 scans reading differently
+    uint64_t delta = raw ^ m->debounced;
+    m->ct0 = ~(m->ct0 & delta);
+    m->ct1 = m->ct0 ^ (m->ct1 & delta);
+    delta &= m->ct0 & m->ct1;
+    m->debounced ^= delta;
+
+    uint64_t changed = m->debounced ^ m->reported;
+    if (!changed) return 0;
+
+    // a change counts as reported once its code is out; what doesn't fit
+    // in out goes on the next scan
+    uint64_t shift = 1ull << MX_KEY_SHIFT;
+    m->reported ^= changed & shift;
+    struct kev_event ev = { 0, 0, 0, 0 };
+    ev.mods = m->debounced & shift ? KEV_MOD_LSHIFT : 0;
+    int n = 0;
+    for (changed &= ~shift; changed; changed &= changed - 1) {
+        int k = __builtin_ctzll(changed);
+        ev.usage = KEV_USAGE_A + k;
+        ev.release = !(m->debounced >> k & 1);
+        int ch = kev_to_char(&ev);
+        if (ch >= 0) {
+            if (n == MX_MAX_EVENTS) break;
+            out[n++] = ch;
+        }
+        m->reported ^= 1ull << k;
+    }
+    m->events += n;
+    return n;
+}
+
+// Typist: types a text in the endpoint's format into the matrix. A key
+// goes down every gap scans and is held for hold scans, shifted keys with
+// shift going down MX_SHIFT_LEAD scans ahead. '#' is a gap with nothing
+// pressed, '@' and '&' press and release capslock. hold greater than gap
+// makes keys overlap, which is where ghosting comes from.
+#define MX_SHIFT_LEAD 8
+#define MX_GAP        24  // defaults: keys well apart, no rollover
+#define MX_HOLD       12
+
+struct mx_typist {
+    const char* text;
+    size_t len;
+    size_t pos;
+    unsigned gap;
+    unsigned hold;
+    unsigned long clock;        // scans so far
+    unsigned long next;         // when the next character starts
+    struct {
+        unsigned long at;
+        int key;
+        int down;
+    } todo[MX_KEYS];            // scheduled switch changes
+    int ntodo;
+};
+
+static inline void mx_typist_init(struct mx_typist* t, const char* text, size_t len, unsigned gap, unsigned hold) {
+    memset(t, 0, sizeof(*t));
+    t->text = text;
+    t->len = len;
+    t->gap = gap;
+    t->hold = hold;
+}
+
+static inline void mx_schedule(struct mx_typist* t, unsigned long at, int key, int down) {
+    if (t->ntodo < MX_KEYS) {
+        t->todo[t->ntodo].at = at;
+        t->todo[t->ntodo].key = key;
+        t->todo[t->ntodo].down = down;
+        t->ntodo++;
+    }
+}
+
+// advances the typist by one scan; 0 once the text is typed and the matrix
+// has settled
+static inline int mx_type(struct mx_typist* t, struct kbd_matrix* m) {
+    unsigned long now = t->clock++;
+
+    if (t->pos < t->len && now >= t->next) {
+        char ch = t->text[t->pos++];
+        struct kev_event ev;
+        int key = kev_from_char(ch, &ev) ? mx_key(ev.usage) : -1;
+        unsigned long down = now;
+
+        if (ch == KEV_CAPSLOCK_PRESS || ch == KEV_CAPSLOCK_RELEASE) mx_schedule(t, now, key, ch == KEV_CAPSLOCK_PRESS);
+        else if (key >= 0 && ch != KEV_NO_EVENT) {
+            if (ev.mods & KEV_MOD_LSHIFT) {
+                // shift first, so it has settled when the key is read
+                down = now + MX_SHIFT_LEAD;
+                mx_schedule(t, now, MX_KEY_SHIFT, 1);
+                mx_schedule(t, down + t->hold, MX_KEY_SHIFT, 0);
+            }
+            mx_schedule(t, down, key, 1);
+            mx_schedule(t, down + t->hold, key, 0);
+        }
+        t->next = down + t->gap;
+    }
+
+    for (int i = 0; i < t->ntodo;) {
+        if (t->todo[i].at > now) {
+            i++;
+            continue;
+        }
+        mx_set(m, t->todo[i].key, t->todo[i].down);
+        t->todo[i] = t->todo[--t->ntodo];
+    }
+    return t->pos < t->len || t->ntodo || m->bouncing || m->physical != m->reported;
+}
+
+#endif
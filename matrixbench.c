@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+#include "matrix.h"
+
+// Key matrix scan benchmark (matrix.h).
+//
+// First one keyboard types the input and what its scans report is checked
+// against the text: the typed keys must come out in order, with capslock
+// as '@'/'&', whatever the bounce did. Then N keyboards type it at once,
+// scanned round-robin on this one thread as fast as it goes, which gives
+// the scans/sec one core manages and so how many keyboards it could keep
+// at the polling rate. -H at or above -g makes keys overlap so
+// anti-ghosting has something to do; keys it holds back are then reported
+// rather than failing the check.
+
+double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+char* read_input(const char* path, size_t* len) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror("unable to open input");
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    rewind(f);
+    char* text = malloc(*len + 1);
+    *len = fread(text, 1, *len, f);
+    fclose(f);
+    return text;
+}
+
+// what the scans should report for a text: every key the matrix has, minus
+// the idle padding, and minus capslock presses/releases that find the switch
+// already that way
+size_t expected(const char* text, size_t len, char* out) {
+    size_t n = 0;
+    int caps = 0;
+    for (size_t i = 0; i < len; i++) {
+        struct kev_event ev;
+        if (text[i] == KEV_NO_EVENT || !kev_from_char(text[i], &ev) || mx_key(ev.usage) < 0) continue;
+        if (ev.usage == KEV_USAGE_CAPSLOCK) {
+            if (caps == !ev.release) continue;
+            caps = !ev.release;
+        }
+        out[n++] = text[i];
+    }
+    return n;
+}
+
+void print_counters(struct kbd_matrix* m) {
+    printf("  %lu scans, %lu events, %lu bounces, %lu ambiguous scans, %lu presses held back\n",
+        m->scans, m->events, m->bounces, m->ghost_scans, m->ghost_blocked);
+}
+
+// More keys change in one scan than a scan can report: row 0 columns 0-4,
+// column 7 rows 1-5 and capslock go down together, then up. No two rows
+// share a column, so nothing ghosts, and the switches are set directly so
+// nothing bounces. What doesn't fit must come out on the next scan.
+int check_burst() {
+    uint64_t keys = 0x1full | 1ull << mx_key(KEV_USAGE_CAPSLOCK);
+    for (int r = 1; r <= 5; r++) keys |= 1ull << (r * 8 + 7);
+
+    char want[2 * MX_KEYS], got[4 * MX_KEYS];
+    size_t nwant = 0, ngot = 0;
+    struct kev_event ev = { 0, 0, 0, 0 };
+    for (int release = 0; release < 2; release++) {
+        for (uint64_t b = keys; b; b &= b - 1) {
+            ev.usage = KEV_USAGE_A + __builtin_ctzll(b);
+            ev.release = release;
+            int ch = kev_to_char(&ev);
+            if (ch >= 0) want[nwant++] = ch;
+        }
+    }
+
+    struct kbd_matrix m;
+    int most = 0;
+    mx_init(&m, 1);
+    for (int release = 0; release < 2; release++) {
+        m.physical = release ? 0 : keys;
+        for (int i = 0; i < 16; i++) {
+            int n = mx_scan(&m, got + ngot);
+            if (n > most) most = n;
+            ngot += n;
+        }
+    }
+
+    int ok = ngot == nwant && !memcmp(got, want, nwant) && m.reported == m.physical;
+    printf("burst: %d keys down and up in one scan, at most %d codes a scan: %s\n",
+        __builtin_popcountll(keys), most, ok ? "reported as typed" : "KEYS LOST");
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    int keyboards = 500;
+    long rate = 8000;
+    unsigned gap = MX_GAP, hold = MX_HOLD;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:r:g:H:")) != -1) {
+        switch (opt) {
+        case 'n': keyboards = atoi(optarg); break;
+        case 'r': rate = atol(optarg); break;
+        case 'g': gap = atoi(optarg); break;
+        case 'H': hold = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-n keyboards] [-r poll_hz] [-g gap_scans] [-H hold_scans] <input>\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (optind >= argc || keyboards < 1) {
+        fprintf(stderr, "Usage: %s [-n keyboards] [-r poll_hz] [-g gap_scans] [-H hold_scans] <input>\n", argv[0]);
+        exit(1);
+    }
+
+    int burst_ok = check_burst();
+
+    size_t len;
+    char* text = read_input(argv[optind], &len);
+
+    // one keyboard, checked
+    char* want = malloc(len + 1);
+    char* got = malloc(2 * len + MX_MAX_EVENTS);
+    size_t nwant = expected(text, len, want), ngot = 0;
+
+    struct kbd_matrix m;
+    struct mx_typist t;
+    mx_init(&m, 1);
+    mx_typist_init(&t, text, len, gap, hold);
+    while (mx_type(&t, &m)) ngot += mx_scan(&m, got + ngot);
+
+    // with overlapping keys anti-ghosting is expected to hold some back
+    int overlap = hold >= gap;
+    int ok = ngot == nwant && !memcmp(got, want, nwant);
+    printf("%s: %zu keys typed, gap %u hold %u scans: %s\n", argv[optind], nwant, gap, hold,
+        ok ? "reported as typed" : overlap ? "keys lost to anti-ghosting" : "REPORTED DIFFERENTLY");
+    if (!ok) {
+        size_t i = 0;
+        while (i < ngot && i < nwant && got[i] == want[i]) i++;
+        printf("  differs at key %zu of %zu (got %zu)\n", i, nwant, ngot);
+    }
+    print_counters(&m);
+
+    // many keyboards on one core
+    struct kbd_matrix* ms = malloc(keyboards * sizeof(*ms));
+    struct mx_typist* ts = malloc(keyboards * sizeof(*ts));
+    for (int i = 0; i < keyboards; i++) {
+        mx_init(&ms[i], i + 1);
+        // start each somewhere else in the text so they don't scan in step
+        size_t off = len ? (size_t)i * 7919 % len : 0;
+        mx_typist_init(&ts[i], text + off, len - off, gap, hold);
+    }
+
+    char out[MX_MAX_EVENTS];
+    unsigned long scans = 0, events = 0;
+    int running = keyboards;
+    double start = now_sec();
+    while (running) {
+        running = 0;
+        for (int i = 0; i < keyboards; i++) {
+            if (!ts[i].text) continue;
+            if (!mx_type(&ts[i], &ms[i])) ts[i].text = NULL;
+            else running++;
+            events += mx_scan(&ms[i], out);
+            scans++;
+        }
+    }
+    double secs = now_sec() - start;
+
+    double per_sec = scans / secs;
+    printf("%d keyboards: %lu scans in %.3fs = %.2f M scans/sec, %.1f ns/scan, %lu events\n",
+        keyboards, scans, secs, per_sec / 1e6, secs * 1e9 / scans, events);
+    printf("  one core keeps %.0f keyboards at %ld Hz\n", per_sec / rate, rate);
+    return (ok || overlap) && burst_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,91 @@
+#ifndef OUTQ_H
+#define OUTQ_H
+
+// Batched output writer for the driver's stdout.
+//
+// Keys are appended to a small buffer, and text that already lives
+// somewhere stable (macro expansions in their arena) is queued by pointer
+// and length, not copied. Both become iovecs, and a flush hands them all to
+// one writev. Consecutive characters grow the same iovec, so a burst of
+// typing is one entry. The caller flushes whenever the output has to be
+// seen: before the LED round trip, whose listener prints to the same
+// stdout, once the endpoint has nothing more to read, and at exit.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#define OUTQ_IOV  1024      // IOV_MAX on Linux
+#define OUTQ_BUF  65536
+
+struct outq {
+    int fd;
+    int niov;
+    size_t used;
+    struct iovec iov[OUTQ_IOV];
+    char buf[OUTQ_BUF];
+
+    // counters
+    unsigned long writes;
+    unsigned long refs;
+    unsigned long long bytes;
+};
+
+static inline void outq_init(struct outq* q, int fd) {
+    q->fd = fd;
+    q->niov = 0;
+    q->used = 0;
+    q->writes = q->refs = q->bytes = 0;
+}
+
+static inline int outq_pending(const struct outq* q) {
+    return q->niov != 0;
+}
+
+static inline void outq_flush(struct outq* q) {
+    struct iovec* iov = q->iov;
+    int n = q->niov;
+    while (n) {
+        ssize_t w = writev(q->fd, iov, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            perror("output write failed");
+            exit(1);
+        }
+        q->writes++;
+        q->bytes += w;
+        // partial write: skip what went out, trim the entry it stopped in
+        for (; n && (size_t)w >= iov->iov_len; iov++, n--) w -= iov->iov_len;
+        if (n) {
+            iov->iov_base = (char*)iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+    q->niov = 0;
+    q->used = 0;
+}
+
+static inline void outq_char(struct outq* q, char ch) {
+    if (q->used == OUTQ_BUF || q->niov == OUTQ_IOV) outq_flush(q);
+    char* at = q->buf + q->used;
+    struct iovec* last = q->niov ? &q->iov[q->niov - 1] : NULL;
+    if (last && (char*)last->iov_base + last->iov_len == at) last->iov_len++;
+    else q->iov[q->niov++] = (struct iovec){ at, 1 };
+    q->buf[q->used++] = ch;
+}
+
+// queues len bytes at p by reference; p must stay valid until the next flush
+static inline void outq_ref(struct outq* q, const char* p, size_t len) {
+    if (!len) return;
+    if (q->niov == OUTQ_IOV) outq_flush(q);
+    q->iov[q->niov++] = (struct iovec){ (void*)p, len };
+    q->refs++;
+}
+
+static inline void outq_print_stats(const struct outq* q) {
+    fprintf(stderr, "\noutput: %llu bytes in %lu writev calls, %lu by reference\n", q->bytes, q->writes, q->refs);
+}
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef RING_H
+#define RING_H
+
+// Shared-memory interrupt endpoint.
+//
+// A single-producer/single-consumer byte ring mapped by both the simulator
+// and the driver, as a faster alternative to the int_pipe FIFO. Keys are
+// published with a release store of head and consumed with an acquire load,
+// so at steady state nothing enters the kernel. A side only sleeps (futex on
+// the index it waits for) when the ring is empty or full, and the other side
+// only issues FUTEX_WAKE when it sees that flag set. The consumer sleeps on
+// wake_seq rather than head so that closing the ring can wake it too.
+
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define RING_SIZE     65536  // power of two
+
+struct kbd_ring {
+    // producer line
+    _Atomic uint32_t head;
+    _Atomic uint32_t wake_seq;
+    _Atomic uint32_t producer_waiting;
+    char pad0[64 - 3 * sizeof(uint32_t)];
+
+    // consumer line
+    _Atomic uint32_t tail;
+    _Atomic uint32_t consumer_waiting;
+    _Atomic uint32_t closed;
+    char pad1[64 - 3 * sizeof(uint32_t)];
+
+    unsigned char data[RING_SIZE];
+};
+
+static inline void ring_futex_wait(_Atomic uint32_t* addr, uint32_t val) {
+    syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0);
+}
+
+static inline void ring_futex_wake(_Atomic uint32_t* addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static inline void ring_init(struct kbd_ring* r) {
+    memset(r, 0, sizeof(*r));
+}
+
+// blocks until all n bytes are in the ring
+static inline void ring_write(struct kbd_ring* r, const void* buf, size_t n) {
+    const unsigned char* p = buf;
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+    while (n > 0) {
+        uint32_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+        uint32_t room = RING_SIZE - (head - tail);
+
+        if (room == 0) {
+            atomic_store(&r->producer_waiting, 1);
+            if (atomic_load(&r->tail) == tail) ring_futex_wait(&r->tail, tail);
+            atomic_store(&r->producer_waiting, 0);
+            continue;
+        }
+
+        uint32_t chunk = n < room ? n : room;
+        uint32_t off = head & (RING_SIZE - 1);
+        uint32_t first = chunk < RING_SIZE - off ? chunk : RING_SIZE - off;
+        memcpy(r->data + off, p, first);
+        memcpy(r->data, p + first, chunk - first);
+
+        head += chunk;
+        p += chunk;
+        n -= chunk;
+        atomic_store(&r->head, head);
+        if (atomic_load(&r->consumer_waiting)) {
+            atomic_fetch_add(&r->wake_seq, 1);
+            ring_futex_wake(&r->wake_seq);
+        }
+    }
+}
+
+// bytes ready for the consumer, without blocking
+static inline uint32_t ring_avail(struct kbd_ring* r) {
+    return atomic_load_explicit(&r->head, memory_order_acquire)
+        - atomic_load_explicit(&r->tail, memory_order_relaxed);
+}
+
+static inline int ring_closed(struct kbd_ring* r) {
+    return atomic_load(&r->closed);
+}
+
+// blocks until at least one byte is available, returns 0 once the producer
+// has closed the ring and it is drained
+static inline size_t ring_read(struct kbd_ring* r, void* buf, size_t max) {
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint32_t head;
+
+    while ((head = atomic_load_explicit(&r->head, memory_order_acquire)) == tail) {
+        if (atomic_load(&r->closed)) {
+            // closed is set after the last head store, look once more
+            if (atomic_load(&r->head) == tail) return 0;
+            continue;
+        }
+        atomic_store(&r->consumer_waiting, 1);
+        uint32_t seq = atomic_load(&r->wake_seq);
+        if (atomic_load(&r->head) == tail && !atomic_load(&r->closed))
+            ring_futex_wait(&r->wake_seq, seq);
+        atomic_store(&r->consumer_waiting, 0);
+    }
+
+    uint32_t avail = head - tail;
+    uint32_t chunk = avail < max ? avail : max;
+    uint32_t off = tail & (RING_SIZE - 1);
+    uint32_t first = chunk < RING_SIZE - off ? chunk : RING_SIZE - off;
+    memcpy(buf, r->data + off, first);
+    memcpy((unsigned char*)buf + first, r->data, chunk - first);
+
+    // seq_cst, like the producer's head store: the tail store and the
+    // producer_waiting load must not reorder, or a producer that just saw
+    // the old tail sleeps with nobody left to wake it
+    atomic_store(&r->tail, tail + chunk);
+    if (atomic_load(&r->producer_waiting)) ring_futex_wake(&r->tail);
+    return chunk;
+}
+
+static inline void ring_close(struct kbd_ring* r) {
+    atomic_store(&r->closed, 1);
+    atomic_fetch_add(&r->wake_seq, 1);
+    ring_futex_wake(&r->wake_seq);
+}
+
+#endif
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "ring.h"
+
+// Interrupt endpoint throughput: int_pipe FIFO vs the shared-memory ring.
+// A simulator process pushes keys in report-sized batches and a driver
+// process drains them, counting what it got.
+
+#define NO_EVENT '#'
+
+double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// drains the endpoint, returns the number of keys and voluntary switches
+void consume(int fd, struct kbd_ring* ring, long* keys, long* sleeps) {
+    unsigned char buf[4096];
+    long n = 0;
+
+    while (1) {
+        ssize_t got = ring ? (ssize_t)ring_read(ring, buf, sizeof(buf)) : read(fd, buf, sizeof(buf));
+        if (got <= 0) break;
+        n += got;
+    }
+
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    *keys = n;
+    *sleeps = ru.ru_nvcsw;
+}
+
+void run(const char* name, long total, int batch, int use_ring) {
+    int fds[2] = { -1, -1 };
+    struct kbd_ring* ring = NULL;
+    long* result = mmap(0, 2 * sizeof(long), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (use_ring) {
+        ring = mmap(0, sizeof(*ring), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        ring_init(ring);
+    }
+    else if (pipe(fds) < 0) {
+        perror("pipe failed");
+        exit(1);
+    }
+
+    double start = now_sec();
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (!use_ring) close(fds[1]);
+        consume(fds[0], ring, &result[0], &result[1]);
+        _exit(0);
+    }
+    if (!use_ring) close(fds[0]);
+
+    unsigned char* keys = malloc(batch);
+    for (int i = 0; i < batch; i++) keys[i] = 'a' + i % 26;
+
+    for (long sent = 0; sent < total; sent += batch) {
+        if (use_ring) ring_write(ring, keys, batch);
+        else write(fds[1], keys, batch);
+    }
+
+    if (use_ring) ring_close(ring);
+    else close(fds[1]);
+    waitpid(pid, NULL, 0);
+    double secs = now_sec() - start;
+
+    printf("%-5s batch %4d: %10ld keys in %.3fs = %6.2f M keys/sec, driver slept %ld times\n",
+        name, batch, result[0], secs, result[0] / secs / 1e6, result[1]);
+
+    free(keys);
+    munmap(result, 2 * sizeof(long));
+    if (ring) munmap(ring, sizeof(*ring));
+}
+
+int main(int argc, char* argv[]) {
+    long total = argc > 1 ? atol(argv[1]) : 100000000;
+    int batches[] = { 1, 8, 64, 512 };
+
+    for (int i = 0; i < 4; i++) {
+        long n = batches[i] == 1 ? total / 20 : total;
+        run("fifo", n, batches[i], 0);
+        run("ring", n, batches[i], 1);
+    }
+    return 0;
+}